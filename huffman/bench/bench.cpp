@@ -0,0 +1,226 @@
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "extrapolate.h"
+#include "huffman.h"
+#include "sdrhuff.h"
+
+using namespace std;
+
+// Noise levels used to vary the entropy of the quantization codes
+static const float noiseLevels[] = {0.02f, 0.2f, 2.0f};
+static const float benchMaxError = 1E-2f;
+
+// Same signal model as generate-datasets/generate-input.cpp (sine + gaussian noise),
+// but with a fixed seed so runs are comparable
+static vector<float> generateSine(size_t n, float noiseStdDev) {
+    const float period = 100.0f;
+    const float amplitude = 10.0f;
+    const float verticalShift = 10.0f;
+
+    mt19937 gen(42);
+    normal_distribution<float> dis(0, noiseStdDev);
+
+    vector<float> data(n);
+    for (size_t i = 0; i < n; ++i) {
+        data[i] = dis(gen) + sin(i * 2 * 3.1415f / period) * amplitude + verticalShift;
+    }
+    return data;
+}
+
+// Simplified standalone quantizer that produces realistic codes for the Huffman
+// benchmarks. Unlike sdrhuff::compress it has no escapes, exact samples or
+// fused histogram, so it does not measure the library's quantizer.
+static vector<int> quantize(const vector<float> &data, float maxError,
+                            ExtrapolationMethod method) {
+    vector<float> lossyData(data.size());
+    lossyData[0] = data[0];
+    lossyData[1] = data[1];
+
+    vector<int> buckets;
+    buckets.reserve(data.size() - 2);
+    for (size_t i = 2; i < data.size(); ++i) {
+        const float extrapolatedFloat = extrapolateNext(lossyData, i, method);
+        const float err = data[i] - extrapolatedFloat;
+        int bucket = round(err / (2 * maxError));
+        buckets.push_back(bucket);
+        lossyData[i] = extrapolatedFloat + bucket * 2 * maxError;
+    }
+    return buckets;
+}
+
+// Quantized synthetic input together with its Huffman tree and code table
+struct CodedInput {
+    vector<float> data;
+    vector<int> buckets;
+    Histogram histogram;
+    NodePool nodes;
+    vector<Node *> heap;
+    Node *tree;
+    HuffmanCode code;
+
+    CodedInput(size_t n, float noiseStdDev) {
+        data = generateSine(n, noiseStdDev);
+        buckets = quantize(data, benchMaxError, linear);
+        countFrequencies(buckets, histogram);
+        tree = generateHuffmanTree(histogram, nodes, heap);
+        getHuffmanCode(tree, histogram.minValue, histogram.maxValue(), code);
+    }
+};
+
+// Arguments: {number of samples, noise level index}
+static void sizesAndEntropies(benchmark::internal::Benchmark *b) {
+    b->ArgNames({"n", "noise"});
+    for (long long n : {1LL << 12, 1LL << 16, 1LL << 20}) {
+        for (long long noise = 0; noise < 3; ++noise) {
+            b->Args({n, noise});
+        }
+    }
+}
+
+static void BM_GenerateHuffmanTree(benchmark::State &state) {
+    CodedInput input(state.range(0), noiseLevels[state.range(1)]);
+    NodePool nodes;
+    vector<Node *> heap;
+
+    size_t symbols = 0;
+    for (auto _ : state) {
+        Node *tree = generateHuffmanTree(input.histogram, nodes, heap);
+        benchmark::DoNotOptimize(tree);
+        symbols = (nodes.nodes.size() + 1) / 2;
+    }
+    state.counters["symbols"] = symbols;
+}
+BENCHMARK(BM_GenerateHuffmanTree)->Apply(sizesAndEntropies);
+
+static void BM_Encode(benchmark::State &state) {
+    CodedInput input(state.range(0), noiseLevels[state.range(1)]);
+    vector<uint8_t> out;
+
+    unsigned long long bits = 0;
+    for (auto _ : state) {
+        out.clear();
+        BitWriter writer(out);
+        encode(input.buckets.data(), input.buckets.size(), nullptr, input.code, writer);
+        bits = writer.flush();
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * input.buckets.size());
+    state.SetBytesProcessed(state.iterations() * input.data.size() * sizeof(float));
+    state.counters["bits/sample"] = (double)bits / input.buckets.size();
+}
+BENCHMARK(BM_Encode)->Apply(sizesAndEntropies);
+
+static void BM_Decode(benchmark::State &state) {
+    CodedInput input(state.range(0), noiseLevels[state.range(1)]);
+    vector<uint8_t> encoded;
+    BitWriter writer(encoded);
+    encode(input.buckets.data(), input.buckets.size(), nullptr, input.code, writer);
+    const unsigned long long bits = writer.flush();
+    vector<int> decoded(input.buckets.size());
+    vector<int> outliers;
+
+    for (auto _ : state) {
+        BitReader reader(encoded.data(), bits);
+        decode(reader, input.tree, decoded.data(), decoded.size(), outliers);
+        benchmark::DoNotOptimize(decoded.data());
+    }
+    state.SetItemsProcessed(state.iterations() * input.buckets.size());
+    state.SetBytesProcessed(state.iterations() * input.data.size() * sizeof(float));
+}
+BENCHMARK(BM_Decode)->Apply(sizesAndEntropies);
+
+static void BM_ExtrapolateNext(benchmark::State &state) {
+    const ExtrapolationMethod method = (ExtrapolationMethod)state.range(0);
+    vector<float> data = generateSine(state.range(1), noiseLevels[1]);
+
+    for (auto _ : state) {
+        float sum = 0;
+        for (size_t i = 2; i < data.size(); ++i) {
+            sum += extrapolateNext(data, i, method);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * (data.size() - 2));
+}
+BENCHMARK(BM_ExtrapolateNext)
+    ->ArgNames({"method", "n"})
+    ->ArgsProduct({{linear, piecewise, quadratic, none, regression},
+                   {1 << 12, 1 << 16, 1 << 20}});
+
+static void BM_BitWriter(benchmark::State &state) {
+    const size_t n = state.range(0);
+    const int width = state.range(1);
+    vector<uint8_t> out;
+
+    for (auto _ : state) {
+        out.clear();
+        BitWriter writer(out);
+        for (size_t i = 0; i < n; ++i) {
+            writer.write(i & ((1ULL << width) - 1), width);
+        }
+        writer.flush();
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * out.size());
+}
+BENCHMARK(BM_BitWriter)
+    ->ArgNames({"n", "width"})
+    ->ArgsProduct({{1 << 16, 1 << 20}, {1, 3, 8, 32}});
+
+static void BM_BitReader(benchmark::State &state) {
+    const size_t n = state.range(0);
+    vector<uint8_t> bytes(n / 8);
+    mt19937 gen(42);
+    for (uint8_t &byte : bytes) {
+        byte = gen();
+    }
+
+    for (auto _ : state) {
+        BitReader reader(bytes.data(), n);
+        unsigned ones = 0;
+        for (size_t i = 0; i < n; ++i) {
+            ones += reader.readBit();
+        }
+        benchmark::DoNotOptimize(ones);
+    }
+    state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_BitReader)->ArgName("n")->Arg(1 << 20)->Arg(1 << 24);
+
+static void BM_Compress(benchmark::State &state) {
+    vector<float> data = generateSine(state.range(0), noiseLevels[state.range(1)]);
+    sdrhuff::CompressionParams params;
+    params.error = benchMaxError;
+    sdrhuff::CompressionContext ctx;
+    vector<uint8_t> out;
+
+    for (auto _ : state) {
+        sdrhuff::compress(ctx, data.data(), data.size(), params, out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * data.size() * sizeof(float));
+    state.counters["ratio"] = (double)data.size() * sizeof(float) / out.size();
+}
+BENCHMARK(BM_Compress)->Apply(sizesAndEntropies);
+
+static void BM_Decompress(benchmark::State &state) {
+    vector<float> data = generateSine(state.range(0), noiseLevels[state.range(1)]);
+    sdrhuff::CompressionParams params;
+    params.error = benchMaxError;
+    vector<uint8_t> compressed = sdrhuff::compress(data, params);
+    sdrhuff::DecompressionContext ctx;
+    vector<float> out;
+
+    for (auto _ : state) {
+        sdrhuff::decompress(ctx, compressed.data(), compressed.size(), out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * data.size() * sizeof(float));
+}
+BENCHMARK(BM_Decompress)->Apply(sizesAndEntropies);
+
+BENCHMARK_MAIN();
@@ -1,44 +1,429 @@
 #include <iostream>
-#include <fstream>
-#include <random>
 #include <cmath>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 using namespace std;
 
-int main()
+// Samples per chunk. Chunks are filled independently by the worker threads; the
+// output depends only on the parameters, not on the number of threads.
+const size_t chunkSize = 1 << 20;
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random numbers:
+// as easy as 1, 2, 3"). Every (counter, stream) pair maps to 4 independent words,
+// so any sample can be generated without generating the ones before it.
+struct Philox
 {
-    const bool print = false;
-    const int n = 10000000;
-    const float period = 100.0f;
-    const float amplitude = 10.0f;
-    const float verticalShift = 10.0f;
-    const float noiseStdDev = 0.2f;
-    const string outputPath = "continuous-tests/sine-10m.in";
+    uint32_t key[2];
 
-    random_device rd;
-    mt19937 gen(rd());
-    normal_distribution<float> dis(0, noiseStdDev);
+    explicit Philox(uint64_t seed) : key{(uint32_t)seed, (uint32_t)(seed >> 32)} {}
 
-    ofstream out(outputPath, ios::binary | ios::out);
-    if (!out)
+    array<uint32_t, 4> operator()(uint64_t counter, uint32_t stream) const
+    {
+        uint32_t c[4] = {(uint32_t)counter, (uint32_t)(counter >> 32), stream, 0};
+        uint32_t k0 = key[0], k1 = key[1];
+        for (int round = 0; round < 10; ++round)
+        {
+            const uint64_t p0 = (uint64_t)0xD2511F53 * c[0];
+            const uint64_t p1 = (uint64_t)0xCD9E8D57 * c[2];
+            const uint32_t next[4] = {(uint32_t)(p1 >> 32) ^ c[1] ^ k0, (uint32_t)p1,
+                                      (uint32_t)(p0 >> 32) ^ c[3] ^ k1, (uint32_t)p0};
+            memcpy(c, next, sizeof(c));
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+        return {c[0], c[1], c[2], c[3]};
+    }
+};
+
+// Uniform in (0, 1)
+inline double uniform(uint32_t word)
+{
+    return ((word >> 8) + 0.5) / (1 << 24);
+}
+
+// Standard normal from two uniform words (Box-Muller)
+inline double normal(uint32_t word0, uint32_t word1)
+{
+    return sqrt(-2 * log(uniform(word0))) * cos(2 * M_PI * uniform(word1));
+}
+
+// Streams of the generator, so that each use of randomness is independent
+enum Stream : uint32_t
+{
+    noiseStream,
+    segmentStream,
+    modeStream
+};
+
+enum Model
+{
+    sine,
+    walk,
+    smooth,
+    spikes,
+    piecewise
+};
+
+struct Parameters
+{
+    string modelName;
+    Model model = sine;
+    string outputPath;
+    size_t n = 10000000;
+    // Grid of the smooth fields, x varying fastest; its product overrides n
+    vector<size_t> dims;
+    uint64_t seed = 1;
+    unsigned threads = thread::hardware_concurrency();
+    float period = 100.0f;
+    float amplitude = 10.0f;
+    float verticalShift = 10.0f;
+    float noiseStdDev = 0.2f;
+    // Fraction of samples replaced by a spike, and the spike height
+    double spikeRate = 1E-3;
+    float spikeAmplitude = 100.0f;
+    // Samples per constant segment
+    size_t segmentLength = 1000;
+    // Number of random plane waves summed by the smooth fields
+    int modes = 8;
+};
+
+// Plane wave of a smooth field: amplitude * sin(2 pi (k . x) + phase)
+struct Mode
+{
+    double amplitude;
+    double phase;
+    double k[3];
+};
+
+// Low-frequency modes with amplitudes decaying with the frequency, drawn once
+// from the seed
+vector<Mode> makeModes(const Parameters &params)
+{
+    const Philox philox(params.seed);
+    vector<Mode> modes(params.modes);
+    for (int m = 0; m < params.modes; ++m)
+    {
+        const array<uint32_t, 4> a = philox(2 * m, modeStream);
+        const array<uint32_t, 4> b = philox(2 * m + 1, modeStream);
+        Mode &mode = modes[m];
+        double norm = 0;
+        for (size_t d = 0; d < 3; ++d)
+        {
+            // Up to 4 periods across the grid along each axis
+            const double waves = d < params.dims.size() ? 4 * (2 * uniform(a[d]) - 1) : 0;
+            mode.k[d] = d < params.dims.size() ? waves / params.dims[d] : 0;
+            norm += waves * waves;
+        }
+        mode.amplitude = params.amplitude / (1 + norm) * (0.5 + uniform(a[3]));
+        mode.phase = 2 * M_PI * uniform(b[0]);
+    }
+    return modes;
+}
+
+// Fills samples [start, start + count) of every model but the random walk
+void fillChunk(const Parameters &params, const vector<Mode> &modes, size_t start, size_t count,
+               float *out)
+{
+    const Philox philox(params.seed);
+    const double frequency = 2 * M_PI / params.period;
+    for (size_t i = start; i < start + count; ++i)
+    {
+        const array<uint32_t, 4> r = philox(i, noiseStream);
+        const double noise = params.noiseStdDev * normal(r[0], r[1]);
+        double value;
+        if (params.model == sine)
+        {
+            value = sin(i * frequency) * params.amplitude + params.verticalShift;
+        }
+        else if (params.model == spikes)
+        {
+            value = sin(i * frequency) * params.amplitude + params.verticalShift;
+            if (uniform(r[2]) < params.spikeRate)
+            {
+                value += params.spikeAmplitude * (2 * uniform(r[3]) - 1);
+            }
+        }
+        else if (params.model == piecewise)
+        {
+            const size_t segment = i / params.segmentLength;
+            const array<uint32_t, 4> level = philox(segment, segmentStream);
+            value = params.verticalShift + params.amplitude * (2 * uniform(level[0]) - 1);
+        }
+        else
+        {
+            // Smooth 2D or 3D field
+            size_t index = i;
+            double x[3] = {};
+            for (size_t d = 0; d < params.dims.size(); ++d)
+            {
+                x[d] = index % params.dims[d];
+                index /= params.dims[d];
+            }
+            value = params.verticalShift;
+            for (const Mode &mode : modes)
+            {
+                value += mode.amplitude *
+                         sin(2 * M_PI * (mode.k[0] * x[0] + mode.k[1] * x[1] + mode.k[2] * x[2]) + mode.phase);
+            }
+        }
+        out[i - start] = (float)(value + noise);
+    }
+}
+
+// Random walk: steps are drawn per chunk, then each chunk is offset by the sum of
+// the steps of the chunks before it. Sums are kept in double per chunk, so the
+// result does not depend on the number of threads.
+template <typename ForEachChunk>
+void fillRandomWalk(const Parameters &params, float *out, ForEachChunk &&forEachChunk)
+{
+    const Philox philox(params.seed);
+    const size_t numChunks = (params.n + chunkSize - 1) / chunkSize;
+    vector<double> chunkSums(numChunks);
+    forEachChunk([&](size_t chunk, size_t start, size_t count) {
+        double sum = 0;
+        for (size_t i = start; i < start + count; ++i)
+        {
+            const array<uint32_t, 4> r = philox(i, noiseStream);
+            sum += params.noiseStdDev * normal(r[0], r[1]);
+        }
+        chunkSums[chunk] = sum;
+    });
+
+    vector<double> offsets(numChunks);
+    double total = params.verticalShift;
+    for (size_t chunk = 0; chunk < numChunks; ++chunk)
+    {
+        offsets[chunk] = total;
+        total += chunkSums[chunk];
+    }
+
+    forEachChunk([&](size_t chunk, size_t start, size_t count) {
+        double value = offsets[chunk];
+        for (size_t i = start; i < start + count; ++i)
+        {
+            const array<uint32_t, 4> r = philox(i, noiseStream);
+            value += params.noiseStdDev * normal(r[0], r[1]);
+            out[i] = (float)value;
+        }
+    });
+}
+
+void printUsage()
+{
+    cerr << "Usage: generate-input <model> <output> [--n samples] [--dims x,y[,z]] [--seed s]\n"
+         << "                      [--threads t] [--period p] [--amplitude a] [--shift s]\n"
+         << "                      [--noise stddev] [--spike-rate r] [--spike-amplitude a]\n"
+         << "                      [--segment length] [--modes m]\n"
+         << "Models: sine, walk, smooth2d, smooth3d, spikes, piecewise\n"
+         << "--dims applies to smooth2d and smooth3d only, and replaces --n.\n"
+         << "Writes raw float32 samples; the same parameters always give the same file.\n";
+}
+
+bool parseArguments(int argc, char *argv[], Parameters &params)
+{
+    if (argc < 3 || (argc - 3) % 2 != 0)
+    {
+        return false;
+    }
+    params.modelName = argv[1];
+    params.outputPath = argv[2];
+    for (int i = 3; i < argc; i += 2)
+    {
+        const string option = argv[i];
+        const string value = argv[i + 1];
+        if (option == "--n")
+        {
+            params.n = stoull(value);
+        }
+        else if (option == "--dims")
+        {
+            stringstream dims(value);
+            string dim;
+            while (getline(dims, dim, ','))
+            {
+                params.dims.push_back(stoull(dim));
+            }
+        }
+        else if (option == "--seed")
+        {
+            params.seed = stoull(value);
+        }
+        else if (option == "--threads")
+        {
+            params.threads = stoul(value);
+        }
+        else if (option == "--period")
+        {
+            params.period = stof(value);
+        }
+        else if (option == "--amplitude")
+        {
+            params.amplitude = stof(value);
+        }
+        else if (option == "--shift")
+        {
+            params.verticalShift = stof(value);
+        }
+        else if (option == "--noise")
+        {
+            params.noiseStdDev = stof(value);
+        }
+        else if (option == "--spike-rate")
+        {
+            params.spikeRate = stod(value);
+        }
+        else if (option == "--spike-amplitude")
+        {
+            params.spikeAmplitude = stof(value);
+        }
+        else if (option == "--segment")
+        {
+            params.segmentLength = stoull(value);
+        }
+        else if (option == "--modes")
+        {
+            params.modes = stoi(value);
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    static const map<string, Model> models = {{"sine", sine},         {"walk", walk},
+                                              {"smooth2d", smooth},   {"smooth3d", smooth},
+                                              {"spikes", spikes},     {"piecewise", piecewise}};
+    auto it = models.find(params.modelName);
+    if (it == models.end())
+    {
+        return false;
+    }
+    params.model = it->second;
+    if (params.model == smooth)
+    {
+        const size_t ndims = params.modelName == "smooth2d" ? 2 : 3;
+        if (params.dims.empty())
+        {
+            // Square or cubic grid of about n samples
+            params.dims.assign(ndims, (size_t)round(pow((double)params.n, 1.0 / ndims)));
+        }
+        if (params.dims.size() != ndims)
+        {
+            return false;
+        }
+        params.n = 1;
+        for (size_t dim : params.dims)
+        {
+            params.n *= dim;
+        }
+    }
+    else if (!params.dims.empty())
+    {
+        // The other models are 1-D, sized by --n only
+        return false;
+    }
+    params.threads = max(params.threads, 1U);
+    params.segmentLength = max<size_t>(params.segmentLength, 1);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    Parameters params;
+    try
+    {
+        if (!parseArguments(argc, argv, params))
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    catch (const logic_error &)
+    {
+        printUsage();
+        return 1;
+    }
+
+    // The output is mapped into memory and every thread writes its chunks in place
+    const size_t size = params.n * sizeof(float);
+    const int fd = open(params.outputPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size) != 0)
     {
         cerr << "Error creating the file.\n";
         return 1;
     }
+    float *out = nullptr;
+    if (size > 0)
+    {
+        void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            cerr << "Error mapping the file.\n";
+            close(fd);
+            return 1;
+        }
+        out = static_cast<float *>(mapped);
+    }
 
-    float random;
+    // Runs f(chunk, start, count) for every chunk, spread over the threads
+    auto forEachChunk = [&](auto &&f) {
+        const size_t numChunks = (params.n + chunkSize - 1) / chunkSize;
+        atomic<size_t> nextChunk{0};
+        auto worker = [&]() {
+            for (size_t chunk = nextChunk++; chunk < numChunks; chunk = nextChunk++)
+            {
+                const size_t start = chunk * chunkSize;
+                f(chunk, start, min(chunkSize, params.n - start));
+            }
+        };
+        vector<thread> pool;
+        for (unsigned i = 1; i < params.threads; ++i)
+        {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (thread &t : pool)
+        {
+            t.join();
+        }
+    };
 
-    if (print) cout << "Data being generated: ";
-    for (int i = 0; i < n; ++i)
+    auto startTime = chrono::high_resolution_clock::now();
+    if (params.model == walk)
     {
-        random = dis(gen) + sin(i * 2 * 3.1415f / period) * amplitude + verticalShift;
-        if (print) cout << random << " ";
-        out.write(reinterpret_cast<const char *>(&random), sizeof(random));
+        fillRandomWalk(params, out, forEachChunk);
+    }
+    else
+    {
+        const vector<Mode> modes = params.model == smooth ? makeModes(params) : vector<Mode>();
+        forEachChunk([&](size_t, size_t start, size_t count) {
+            fillChunk(params, modes, start, count, out + start);
+        });
     }
 
-    out.close();
+    if (size > 0)
+    {
+        munmap(out, size);
+    }
+    close(fd);
+    auto endTime = chrono::high_resolution_clock::now();
+    const double elapsedTime = chrono::duration<double>(endTime - startTime).count();
 
-    cout << "\nFile generated.\n";
+    cout << "Generated " << params.n << " " << params.modelName << " samples (" << size / (1024.0 * 1024)
+         << " MB) in " << elapsedTime << " s, " << size / (1024.0 * 1024) / elapsedTime << " MB/s\n";
 
     return 0;
 }
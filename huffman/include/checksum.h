@@ -0,0 +1,10 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+// 32-bit xxHash (XXH32) of a byte range
+uint32_t xxhash32(const void *data, size_t size, uint32_t seed = 0);
+
+#endif // CHECKSUM_H
@@ -0,0 +1,115 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "extrapolate.h"
+
+using namespace std;
+
+namespace sdrhuff {
+
+    // Container layout (fields in native little-endian byte order):
+    //   char[4]  magic "SDRH"
+    //   uint16   version
+    //   uint16   flags            see pointwiseRelativeFlag, fixedRateFlag, progressiveFlag
+    //                             and tableReuseFlag
+    //   uint8    dtype, predictor, coder, ndims
+    //   uint64   dims[ndims]
+    //   double   maxError         absolute error bound used by the quantizer, or
+    //                             bits per sample in fixed-rate mode
+    //   uint32   blockSize        samples per block, the last block may be shorter
+    //   uint32   numBlocks
+    //   per block: uint64 offset (from the end of the header), uint32 size, uint32 checksum
+    //   uint32   header checksum  xxHash32 of all preceding header bytes
+    //   blocks, each independently decodable
+    const uint8_t containerMagic[4] = {'S', 'D', 'R', 'H'};
+    const uint16_t containerVersion = 1;
+    const int maxDims = 4;
+
+    // Blocks hold log2 magnitudes plus signs, and maxError is a bound in the log
+    // domain. Set by the point-wise relative error mode.
+    const uint16_t pointwiseRelativeFlag = 1;
+    // Every block is padded to exactly ceil(count * maxError / 8) bytes and starts
+    // with its own error bound. Set by the fixed-rate error mode.
+    const uint16_t fixedRateFlag = 2;
+    // Blocks are stored as multilevel interpolation layers that can be decoded
+    // coarse to fine. Set when CompressionParams::levels > 0.
+    const uint16_t progressiveFlag = 4;
+    // Blocks may reference the Huffman table of an earlier block or of a dataset
+    // dictionary instead of storing their own. Set by CompressionParams::reuseTables
+    // or when compressing with a dictionary.
+    const uint16_t tableReuseFlag = 8;
+
+    enum DataType {
+        float32,
+        float64,
+        int16,
+        int32
+    };
+
+    // Maps an element type to its DataType tag
+    template <typename T>
+    constexpr DataType dataTypeOf();
+    template <>
+    constexpr DataType dataTypeOf<float>() { return float32; }
+    template <>
+    constexpr DataType dataTypeOf<double>() { return float64; }
+    template <>
+    constexpr DataType dataTypeOf<int16_t>() { return int16; }
+    template <>
+    constexpr DataType dataTypeOf<int32_t>() { return int32; }
+
+    // Size in bytes of an element of the given type
+    size_t dataTypeSize(DataType dtype);
+
+    // Back-end that codes the quantization codes of each block
+    enum EntropyCoder {
+        huffmanCoder,
+        // Codes and outliers stored as one zstd frame, so that LZ matching can
+        // exploit repeated runs of codes that Huffman coding cannot
+        zstdCoder,
+        // Huffman tree and encoded data compressed again as one zstd frame
+        huffmanZstdCoder
+    };
+
+    struct BlockInfo {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t checksum; // xxHash32 of the block's bytes
+    };
+
+    struct ContainerHeader {
+        uint16_t version = containerVersion;
+        uint16_t flags = 0;
+        DataType dtype = float32;
+        ExtrapolationMethod predictor = linear;
+        EntropyCoder coder = huffmanCoder;
+        vector<uint64_t> dims;
+        double maxError = 0;
+        uint32_t blockSize = 0;
+        vector<BlockInfo> blocks;
+
+        // Total number of samples, the product of dims
+        uint64_t count() const;
+        // Number of samples in block i
+        uint64_t blockCount(size_t i) const;
+        // Serialized size, determined by the number of dims and blocks
+        size_t size() const;
+    };
+
+    // Serialized size of a header with the given number of dims and blocks
+    size_t containerHeaderSize(size_t ndims, size_t numBlocks);
+
+    // Serializes the header into dst, which must hold header.size() bytes
+    void writeContainerHeader(const ContainerHeader &header, uint8_t *dst);
+
+    // Parses and validates a header, throwing runtime_error on a bad magic, an
+    // unsupported version or a checksum mismatch. Returns the header size.
+    size_t readContainerHeader(const uint8_t *src, size_t srcSize, ContainerHeader &header);
+
+}
+
+#endif // CONTAINER_H
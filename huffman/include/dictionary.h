@@ -0,0 +1,54 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include <cstdint>
+#include <vector>
+
+#include "huffman.h"
+
+using namespace std;
+
+namespace sdrhuff {
+
+    // Dictionary file layout (fields in native little-endian byte order):
+    //   char[4]  magic "SDRD"
+    //   uint16   version
+    //   uint32   id                referenced by the blocks that use the dictionary
+    //   int32    minValue          code of lengths[0]
+    //   uint32   numCodes
+    //   uint8    lengths[numCodes] canonical code lengths, 0 for codes without a codeword
+    //   uint32   checksum          xxHash32 of all preceding bytes
+    const uint8_t dictionaryMagic[4] = {'S', 'D', 'R', 'D'};
+    const uint16_t dictionaryVersion = 1;
+    // Codewords are written with a single BitWriter::write, which takes at most
+    // 56 bits; readDictionary rejects longer ones
+    const int maxDictionaryCodeLength = 56;
+
+    // Pre-trained Huffman table shared by the files of a dataset, see
+    // CompressionParams::dictionary and DecompressionContext::dictionary.
+    // Codewords are canonical, so the code lengths alone define the table.
+    struct HuffmanDictionary {
+        // Codes seen so far by trainDictionary
+        Histogram histogram;
+        HuffmanCode code;
+        NodePool nodes;
+        Node *tree = nullptr;
+        // xxHash32 of minValue and the code lengths
+        uint32_t id = 0;
+    };
+
+    // Assigns canonical codewords to dictionary.code.lengths, then builds the
+    // decoding tree and the id. Throws runtime_error if the lengths do not form
+    // a complete prefix code.
+    void buildDictionary(HuffmanDictionary &dictionary);
+
+    // Appends the dictionary file to out
+    void writeDictionary(const HuffmanDictionary &dictionary, vector<uint8_t> &out);
+
+    // Parses a dictionary file and builds its table, throwing runtime_error on a
+    // bad magic, an unsupported version, a checksum mismatch or invalid lengths
+    void readDictionary(const uint8_t *src, size_t srcSize, HuffmanDictionary &dictionary);
+
+}
+
+#endif // DICTIONARY_H
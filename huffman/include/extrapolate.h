@@ -1,9 +1,11 @@
 #ifndef EXTRAPOLATION_H
 #define EXTRAPOLATION_H
 
+#include <algorithm>
 #include <vector>
 #include <stdexcept>
 #include <cmath>
+#include <type_traits>
 
 using namespace std;
 
@@ -15,6 +17,84 @@ enum ExtrapolationMethod {
     regression
 };
 
-float extrapolateNext(vector<float> &data, int index, const ExtrapolationMethod &method);
+const int maxLookback = 3; // Maximum number of data points to consider for extrapolation
 
-#endif // EXTRAPOLATION_H
\ No newline at end of file
+// Everything an extrapolation step looks at: the first data point and the
+// points right before the one being extrapolated, most recent first
+template <typename T>
+struct ExtrapolationHistory {
+    T first;
+    T previous[maxLookback];
+
+    void push(T value) {
+        for (int i = maxLookback - 1; i > 0; --i) {
+            previous[i] = previous[i - 1];
+        }
+        previous[0] = value;
+    }
+};
+
+// Extrapolates the value at `index` from its history. The method and the
+// arithmetic type are template parameters so per-sample loops can be
+// instantiated once per method and element type.
+template <ExtrapolationMethod method, typename T>
+inline T extrapolate(const ExtrapolationHistory<T> &history, long long index) {
+    const T *previous = history.previous;
+    if (method == none || index < 1) {
+        return history.first;
+    } else if (method == piecewise || index < 2) {
+        return previous[0];
+    } else if (method == linear || index < 3) {
+        return 2 * previous[0] - previous[1];
+    } else if (method == quadratic) {
+        return previous[2] - 3 * previous[1] + 3 * previous[0];
+    } else {
+        // Linear regression over the last n points, with x measured relative to
+        // index so the sums stay small regardless of the position in the series
+        int n = min<long long>(index - 1, maxLookback);
+        T sumX = 0, sumY = 0, sumXY = 0, sumX2 = 0;
+        for (int k = 1; k <= n; k++) {
+            const T x = -k;
+            sumX += x;
+            sumY += previous[k - 1];
+            sumXY += x * previous[k - 1];
+            sumX2 += x * x;
+        }
+        T slope = (n * sumXY - sumX * sumY) / (n * sumX2 - sumX * sumX);
+        T result = (sumY - slope * sumX) / n;
+        if (isnan(result)) {
+            return 2 * previous[0] - previous[1]; // Default to linear extrapolation
+        }
+        return result;
+    }
+}
+
+// Calls f(integral_constant<ExtrapolationMethod, method>()) for the given method,
+// turning a runtime method into a compile-time one outside of hot loops
+template <typename F>
+inline decltype(auto) withExtrapolationMethod(ExtrapolationMethod method, F &&f) {
+    switch (method) {
+    case linear:
+        return f(integral_constant<ExtrapolationMethod, linear>());
+    case piecewise:
+        return f(integral_constant<ExtrapolationMethod, piecewise>());
+    case quadratic:
+        return f(integral_constant<ExtrapolationMethod, quadratic>());
+    case none:
+        return f(integral_constant<ExtrapolationMethod, none>());
+    case regression:
+        return f(integral_constant<ExtrapolationMethod, regression>());
+    }
+    throw runtime_error("Unknown extrapolation method.");
+}
+
+// Instantiated for float and double
+template <typename T>
+T extrapolateNext(const T *data, int index, const ExtrapolationMethod &method);
+
+template <typename T>
+inline T extrapolateNext(const vector<T> &data, int index, const ExtrapolationMethod &method) {
+    return extrapolateNext(data.data(), index, method);
+}
+
+#endif // EXTRAPOLATION_H
@@ -1,12 +1,10 @@
 #ifndef HUFFMAN_H
 #define HUFFMAN_H
 
-#include <string>
-#include <unordered_map>
-#include <queue>
+#include <cstdint>
 #include <iostream>
-#include <sstream>
-#include <fstream>
+#include <limits>
+#include <stdexcept>
 #include <vector>
 
 using namespace std;
@@ -18,19 +16,140 @@ struct Node {
     Node *left, *right;
 };
 
+// Owns the nodes of a Huffman tree. Storage is kept between trees, so
+// rebuilding a tree of similar size does not allocate.
+struct NodePool {
+    vector<Node> nodes;
+
+    // Discards all nodes and makes room for `capacity` new ones
+    void reset(size_t capacity);
+    // Returns nullptr once `capacity` nodes have been created
+    Node *create(int value, unsigned freq);
+};
+
+// Dense frequency table: counts[i] is the frequency of value minValue + i.
+// The window grows on demand and keeps its size across reset() calls.
+struct Histogram {
+    int minValue = 0;
+    vector<unsigned> counts;
+
+    // Zeroes all counts, keeping the current window
+    void reset();
+    // Widens the window so that it covers value
+    void grow(int value);
+
+    void add(int value, unsigned count = 1) {
+        unsigned long long index = (long long)value - minValue;
+        if (index >= counts.size()) {
+            grow(value);
+            index = (long long)value - minValue;
+        }
+        counts[index] += count;
+    }
+
+    unsigned count(int value) const {
+        const unsigned long long index = (long long)value - minValue;
+        return index < counts.size() ? counts[index] : 0;
+    }
+
+    int maxValue() const {
+        return minValue + (int)counts.size() - 1;
+    }
+};
+
+// Dense code table: the codeword of value minValue + i is stored in the
+// lowest lengths[i] bits of bits[i], first bit in the LSB
+struct HuffmanCode {
+    int minValue = 0;
+    vector<uint64_t> bits;
+    vector<uint8_t> lengths;
+};
+
+// Packs bits into a byte buffer, least significant bit first
+struct BitWriter {
+    vector<uint8_t> &out;
+    uint64_t buffer = 0;
+    int count = 0;
+    unsigned long long totalBits = 0;
+
+    explicit BitWriter(vector<uint8_t> &out) : out(out) {}
+
+    // Appends the lowest `length` bits of `bits` (length <= 56)
+    void write(uint64_t bits, int length) {
+        buffer |= bits << count;
+        count += length;
+        totalBits += length;
+        while (count >= 8) {
+            out.push_back(static_cast<uint8_t>(buffer));
+            buffer >>= 8;
+            count -= 8;
+        }
+    }
+
+    // Pads the last byte with zeros. Returns the number of bits written.
+    unsigned long long flush() {
+        if (count > 0) {
+            out.push_back(static_cast<uint8_t>(buffer));
+        }
+        buffer = 0;
+        count = 0;
+        return totalBits;
+    }
+};
+
+// Reads bits packed by BitWriter
+struct BitReader {
+    const uint8_t *data;
+    unsigned long long totalBits;
+    unsigned long long pos = 0;
+
+    BitReader(const uint8_t *data, unsigned long long totalBits) : data(data), totalBits(totalBits) {}
+
+    uint64_t readBits(int length) {
+        uint64_t bits = 0;
+        for (int i = 0; i < length; ++i) {
+            bits |= (uint64_t)readBit() << i;
+        }
+        return bits;
+    }
+
+    bool readBit() {
+        if (pos >= totalBits) {
+            throw runtime_error("Attempted to read past the end of the bit stream.");
+        }
+        bool bit = (data[pos >> 3] >> (pos & 7)) & 1;
+        ++pos;
+        return bit;
+    }
+};
+
 // Function prototypes
-Node *createNode(int value, unsigned freq);
-void generateCode(Node *cur, string path, unordered_map<int, string> &code);
-unordered_map<int, string> getHuffmanCode(Node *huffmanTree);
-Node *generateHuffmanTree(const unordered_map<int, unsigned> &freqMap);
-pair<vector<uint8_t>, unsigned long long> encode(const vector<int> &vec, const unordered_map<int, string> &code);
-vector<int> decode(const string &str, Node *huffmanTree);
-void traverseTree(Node *cur, string &out);
-string serializeTree(Node *tree);
-Node *deserialize(const string &serializedTree, int &i);
-Node *deserializeTree(const string &serializedTree);
-void writeBitsToFile(ofstream &out, const string &bits);
-string readBitsIntoString(ifstream &file, unsigned long long bits);
+void countFrequencies(const vector<int> &vec, Histogram &histogram);
+Node *generateHuffmanTree(const Histogram &histogram, NodePool &pool, vector<Node *> &heap);
+void getHuffmanCode(Node *huffmanTree, int minValue, int maxValue, HuffmanCode &code);
+
+// Quantization codes are stored in a narrow integer type (int8_t, int16_t or int32_t).
+// The smallest value of the type is reserved as an escape: its codeword is followed
+// by the actual value in 32 raw bits. Escaped values are passed separately, in order.
+template <typename CodeT>
+constexpr int escapeCode() {
+    return numeric_limits<CodeT>::min();
+}
+
+// An escaped value equal to exactMarker is followed by two more 32-bit words,
+// low word first, holding a sample as a double. The quantizer stores samples
+// this way when no bucket reconstructs them within the bound.
+const int exactMarker = numeric_limits<int>::min();
+
+template <typename CodeT>
+void encode(const CodeT *values, size_t count, const int *outliers, const HuffmanCode &code,
+            BitWriter &writer);
+template <typename CodeT>
+void decode(BitReader &reader, Node *huffmanTree, CodeT *out, size_t count, vector<int> &outliers);
+void serializeTree(Node *tree, BitWriter &writer);
+// Throws when a leaf value lies outside [minValue, maxValue], the range of the
+// code type the tree was built for
+Node *deserializeTree(BitReader &reader, NodePool &pool, int minValue, int maxValue);
 
 // Structure for comparing nodes in the priority queue
 struct CompareNode {
@@ -0,0 +1,59 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+using namespace std;
+
+// Blocking queue with a fixed capacity, used to hand work between the I/O
+// threads and the codec thread. Producers block while the queue is full, so
+// at most `capacity` items are in flight.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    // Returns false if the queue was closed before the item could be added
+    bool push(T &&item) {
+        unique_lock<mutex> lock(m);
+        notFull.wait(lock, [&] { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and drained
+    bool pop(T &item) {
+        unique_lock<mutex> lock(m);
+        notEmpty.wait(lock, [&] { return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // Wakes up all waiters. Items already queued can still be popped.
+    void close() {
+        lock_guard<mutex> lock(m);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    const size_t capacity;
+    deque<T> items;
+    bool closed = false;
+    mutex m;
+    condition_variable notFull, notEmpty;
+};
+
+#endif // PIPELINE_H
@@ -0,0 +1,312 @@
+#ifndef SDRHUFF_H
+#define SDRHUFF_H
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "container.h"
+#include "dictionary.h"
+#include "extrapolate.h"
+#include "huffman.h"
+
+using namespace std;
+
+enum ErrorMode {
+    absolute,  // |x' - x| <= error
+    relative,  // |x' - x| <= error * (max - min)
+    pointwise, // |x' - x| <= error * |x|, floating-point data only
+    psnr,      // error is the target PSNR in dB, reached over the whole data
+    fixedRate  // error is the bit budget per sample, the bound adapts per block
+};
+
+namespace sdrhuff {
+
+    const uint32_t defaultBlockSize = 1 << 20;
+    const int maxLevels = 16;
+
+    struct CompressionParams {
+        // Interpreted according to errorMode
+        double error;
+        ErrorMode errorMode = absolute;
+        ExtrapolationMethod extrapolationMethod = linear;
+        // Shape recorded in the header; empty means a 1D array of all samples.
+        // The product of the dimensions must equal the number of samples.
+        vector<uint64_t> dims;
+        // Samples per independently decodable block
+        uint32_t blockSize = defaultBlockSize;
+        // When positive, encodes each block as this many multilevel interpolation
+        // layers instead of using the extrapolation method, so that it can be
+        // previewed coarse first (see decompressPreview). blockSize must be a
+        // multiple of 2^(levels - 1).
+        int levels = 0;
+        // Lets a block reuse the Huffman table of the last block that stored one
+        // when that costs fewer bits than storing its own tree. Stored tables then
+        // include the escape code, through which reusing blocks send the values the
+        // table lacks. Ignored in progressive mode, whose layers always store
+        // their own tables.
+        bool reuseTables = false;
+        // When set, blocks may also reference this table instead of storing a tree.
+        // Not owned, and must outlive the call.
+        const HuffmanDictionary *dictionary = nullptr;
+        // Back-end for the quantization codes. The zstd coders require libsdrhuff
+        // to be built with zstd (see zstdSupported) and an absolute, relative,
+        // point-wise relative or PSNR error bound without progressive levels.
+        // Table reuse and dictionaries are ignored with them.
+        EntropyCoder coder = huffmanCoder;
+        // Compression level of the zstd coders
+        int zstdLevel = 3;
+        // When non-empty, extrapolation errors and quantization levels are
+        // dumped to <debugPrefix>-extrap-errors.txt and <debugPrefix>-quantization-levels.txt
+        string debugPrefix;
+    };
+
+    // zstd compression and decompression contexts, created on first use by the
+    // zstd coders and kept for the next blocks
+    struct ZstdState;
+
+    // True when libsdrhuff was built with zstd, so the zstd coders are available
+    bool zstdSupported();
+
+    // Scratch buffers, histogram and code tables reused across compress calls.
+    // Once warmed up on inputs of similar size, compressing allocates nothing.
+    struct CompressionContext {
+        // Quantization codes, 1 or 2 bytes wide depending on the bucket range
+        vector<int8_t> codes8;
+        vector<int16_t> codes16;
+        vector<int> outliers;
+        Histogram histogram;
+        NodePool nodes;
+        vector<Node *> heap;
+        HuffmanCode code;
+        ContainerHeader header;
+        vector<uint8_t> output;
+        // log2 magnitudes in point-wise relative mode
+        vector<double> logMagnitudes;
+        // Reconstructed samples in progressive mode
+        vector<double> reconstructed;
+        // Table reuse state: the block being compressed, and the last block that
+        // stored a table along with its code
+        const HuffmanDictionary *dictionary = nullptr;
+        bool reuseTables = false;
+        uint32_t block = 0;
+        uint32_t tableBlock = 0;
+        HuffmanCode tableCode;
+        // Outliers of a block coded with a reused table, which escapes the codes
+        // the table lacks
+        vector<int> reuseOutliers;
+        // Input of the zstd frame of a block with the zstd coders
+        vector<uint8_t> entropyBuffer;
+        int zstdLevel = 0;
+        shared_ptr<ZstdState> zstd;
+    };
+
+    // Decoding counterpart of CompressionContext
+    struct DecompressionContext {
+        NodePool nodes;
+        vector<int8_t> codes8;
+        vector<int16_t> codes16;
+        vector<int> outliers;
+        ContainerHeader header;
+        vector<double> logMagnitudes;
+        // Dictionary referenced by the compressed data, if any. Not owned.
+        const HuffmanDictionary *dictionary = nullptr;
+        // Table of block tableBlock, kept while decoding the blocks that reference it
+        NodePool tableNodes;
+        Node *table = nullptr;
+        uint32_t tableBlock = 0;
+        // Decompressed zstd frame of a block with the zstd coders
+        vector<uint8_t> entropyBuffer;
+        shared_ptr<ZstdState> zstd;
+    };
+
+    // Upper bound on the compressed size of n samples of any element type
+    size_t compressBound(size_t n, uint32_t blockSize = defaultBlockSize);
+
+    // Range of bits per sample accepted in fixed-rate mode; other rates throw
+    // invalid_argument
+    const double minFixedRate = 1;
+    const double maxFixedRate = 64;
+
+    // Exact compressed size in fixed-rate mode, known before compressing, so the
+    // output can be preallocated. Block i starts at the fixed payload offset
+    // i * fixedRateBlockBytes(blockSize, bitsPerSample). Each block gets its
+    // bitsPerSample share plus a fixed overhead for the bound, seeds and tree.
+    size_t fixedRateSize(size_t n, double bitsPerSample, uint32_t blockSize = defaultBlockSize,
+                         size_t ndims = 1);
+    size_t fixedRateBlockBytes(size_t count, double bitsPerSample);
+
+    // The pipeline is templated on the element type: float, double, int16_t and
+    // int32_t are instantiated. Each type gets its own predictor and quantizer
+    // loops, so nothing dispatches on the type per sample. Samples are predicted
+    // in double; integers are reconstructed exactly when the absolute error is
+    // below 1, and floating-point samples whose reconstruction rounded to T would
+    // miss the bound are stored as is, so the bound holds for every sample.
+
+    // Context-reusing variants. `out` is overwritten and keeps its capacity between calls.
+    template <typename T>
+    size_t compress(CompressionContext &ctx, const T *data, size_t n,
+                    const CompressionParams &params, vector<uint8_t> &out);
+    // Compresses into a caller-provided buffer and returns the number of bytes written.
+    // Throws runtime_error if dstCapacity is too small; compressBound(n) always suffices.
+    template <typename T>
+    size_t compress(CompressionContext &ctx, const T *data, size_t n,
+                    const CompressionParams &params, uint8_t *dst, size_t dstCapacity);
+
+    // Compresses n samples into a self-describing container
+    template <typename T>
+    vector<uint8_t> compress(const T *data, size_t n, const CompressionParams &params) {
+        CompressionContext ctx;
+        vector<uint8_t> out;
+        compress(ctx, data, n, params, out);
+        return out;
+    }
+
+    template <typename T>
+    vector<uint8_t> compress(const vector<T> &data, const CompressionParams &params) {
+        return compress(data.data(), data.size(), params);
+    }
+
+    template <typename T>
+    size_t compress(const T *data, size_t n, const CompressionParams &params,
+                    uint8_t *dst, size_t dstCapacity) {
+        CompressionContext ctx;
+        return compress(ctx, data, n, params, dst, dstCapacity);
+    }
+
+    // Compressibility of the data under a configuration, see estimate
+    struct CompressionEstimate {
+        // Shannon entropy of the quantization codes, in bits per code
+        double entropy = 0;
+        // Exact size compress would produce with the Huffman coder and a table
+        // per block, computed from the code lengths
+        size_t size = 0;
+        double ratio = 0;
+    };
+
+    // Runs the predictor and quantizer and builds the Huffman code lengths, but
+    // emits no bits, so configurations can be screened much faster than by
+    // compressing. Requires an absolute, relative or PSNR error bound and
+    // levels == 0. The estimate is always for the Huffman coder with a table per
+    // block: params.coder, table reuse and dictionaries are ignored.
+    template <typename T>
+    CompressionEstimate estimate(CompressionContext &ctx, const T *data, size_t n,
+                                 const CompressionParams &params);
+
+    // Adds the quantization codes of the data to the dictionary and rebuilds its
+    // canonical table, so it can be trained on a corpus one file at a time. Requires an absolute,
+    // relative or PSNR error bound and levels == 0.
+    template <typename T>
+    void trainDictionary(CompressionContext &ctx, const T *data, size_t n,
+                         const CompressionParams &params, HuffmanDictionary &dictionary);
+
+    // Largest absolute error for which the reconstruction of a sample of the data
+    // reaches the target PSNR (dB), found by bisection. The whole data may fall
+    // slightly short of the target; the psnr error mode starts from this bound
+    // and lowers it until the whole data reaches the target. Exposed so that
+    // error bounds can be tuned per dataset.
+    template <typename T>
+    double maxErrorForPsnr(CompressionContext &ctx, const T *data, size_t n, double targetPsnr,
+                           ExtrapolationMethod extrapolationMethod);
+
+    // Parses and validates the container header without touching the blocks
+    void readHeader(const uint8_t *src, size_t srcSize, ContainerHeader &header);
+
+    // Checks the header and every block checksum without decoding anything
+    bool validate(const uint8_t *src, size_t srcSize);
+
+    // Number of samples stored in a compressed buffer
+    size_t getDecompressedSize(const uint8_t *src, size_t srcSize);
+
+    // Decompressing throws runtime_error on malformed input, a checksum mismatch or
+    // when T is not the element type recorded in the header (see readHeader).
+
+    // Decompresses into a caller-provided buffer and returns the number of samples written.
+    // Throws runtime_error if dstCapacity < getDecompressedSize(src, srcSize).
+    template <typename T>
+    size_t decompress(DecompressionContext &ctx, const uint8_t *src, size_t srcSize,
+                      T *dst, size_t dstCapacity);
+
+    // `out` is resized to the number of decompressed samples
+    template <typename T>
+    size_t decompress(DecompressionContext &ctx, const uint8_t *src, size_t srcSize,
+                      vector<T> &out) {
+        readHeader(src, srcSize, ctx.header);
+        out.resize(ctx.header.count());
+        return decompress(ctx, src, srcSize, out.data(), out.size());
+    }
+
+    template <typename T>
+    size_t decompress(const uint8_t *src, size_t srcSize, T *dst, size_t dstCapacity) {
+        DecompressionContext ctx;
+        return decompress(ctx, src, srcSize, dst, dstCapacity);
+    }
+
+    template <typename T = float>
+    vector<T> decompress(const uint8_t *src, size_t srcSize) {
+        DecompressionContext ctx;
+        vector<T> out;
+        decompress(ctx, src, srcSize, out);
+        return out;
+    }
+
+    template <typename T = float>
+    vector<T> decompress(const vector<uint8_t> &src) {
+        return decompress<T>(src.data(), src.size());
+    }
+
+    // Reconstruction error against the original samples, accumulated in double
+    struct ErrorStats {
+        size_t count = 0;
+        double maxError = 0;
+        double sumError = 0;
+        double sumSquaredError = 0;
+        // Range of the original samples, for PSNR
+        double minValue = numeric_limits<double>::infinity();
+        double maxValue = -numeric_limits<double>::infinity();
+        // Samples whose error exceeds the bound recorded in the container: the
+        // absolute bound, the per-block bound in fixed-rate mode or the relative
+        // bound times |x| in point-wise relative mode
+        size_t violations = 0;
+
+        double meanError() const;
+        double rmse() const;
+        // Infinite for a lossless reconstruction
+        double psnr() const;
+    };
+
+    // Decompresses like decompress and compares each block against `original`
+    // right after it is decoded, while it is still in cache, adding to `stats`
+    template <typename T>
+    size_t decompressAndVerify(DecompressionContext &ctx, const uint8_t *src, size_t srcSize,
+                               const T *original, T *dst, size_t dstCapacity, ErrorStats &stats);
+
+    template <typename T>
+    size_t decompressAndVerify(DecompressionContext &ctx, const uint8_t *src, size_t srcSize,
+                               const T *original, vector<T> &out, ErrorStats &stats) {
+        readHeader(src, srcSize, ctx.header);
+        out.resize(ctx.header.count());
+        return decompressAndVerify(ctx, src, srcSize, original, out.data(), out.size(), stats);
+    }
+
+    // Progressive containers only: decodes the first `levels` levels of every block
+    // and writes every 2^(L - levels)-th sample, where L is the number of levels
+    // stored, returning the number of samples written. Only those layers are read
+    // and the block checksums are not verified, so the cost scales with the
+    // preview size rather than the file size.
+    size_t getPreviewSize(const uint8_t *src, size_t srcSize, int levels);
+    template <typename T>
+    size_t decompressPreview(DecompressionContext &ctx, const uint8_t *src, size_t srcSize, int levels,
+                             T *dst, size_t dstCapacity);
+
+    // Random access: decodes only block `index` (header.blockSize samples, fewer for
+    // the last block) and returns the number of samples written
+    template <typename T>
+    size_t decompressBlock(DecompressionContext &ctx, const uint8_t *src, size_t srcSize,
+                           size_t index, T *dst, size_t dstCapacity);
+
+}
+
+#endif // SDRHUFF_H
@@ -0,0 +1,70 @@
+#include "checksum.h"
+
+#include <cstring>
+
+static const uint32_t prime1 = 0x9E3779B1U;
+static const uint32_t prime2 = 0x85EBCA77U;
+static const uint32_t prime3 = 0xC2B2AE3DU;
+static const uint32_t prime4 = 0x27D4EB2FU;
+static const uint32_t prime5 = 0x165667B1U;
+
+static inline uint32_t rotateLeft(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t round32(uint32_t acc, uint32_t input) {
+    acc += input * prime2;
+    acc = rotateLeft(acc, 13);
+    return acc * prime1;
+}
+
+uint32_t xxhash32(const void *data, size_t size, uint32_t seed) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    const uint8_t *end = p + size;
+    uint32_t h;
+
+    if (size >= 16) {
+        // Four independent lanes over 16-byte stripes
+        uint32_t v1 = seed + prime1 + prime2;
+        uint32_t v2 = seed + prime2;
+        uint32_t v3 = seed;
+        uint32_t v4 = seed - prime1;
+        const uint8_t *limit = end - 16;
+        do {
+            v1 = round32(v1, read32(p));
+            v2 = round32(v2, read32(p + 4));
+            v3 = round32(v3, read32(p + 8));
+            v4 = round32(v4, read32(p + 12));
+            p += 16;
+        } while (p <= limit);
+        h = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) + rotateLeft(v4, 18);
+    } else {
+        h = seed + prime5;
+    }
+
+    h += (uint32_t)size;
+
+    while (p + 4 <= end) {
+        h += read32(p) * prime3;
+        h = rotateLeft(h, 17) * prime4;
+        p += 4;
+    }
+    while (p < end) {
+        h += (*p) * prime5;
+        h = rotateLeft(h, 11) * prime1;
+        p++;
+    }
+
+    h ^= h >> 15;
+    h *= prime2;
+    h ^= h >> 13;
+    h *= prime3;
+    h ^= h >> 16;
+    return h;
+}
@@ -0,0 +1,148 @@
+#include "container.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "checksum.h"
+
+namespace sdrhuff {
+
+    static const size_t fixedHeaderSize = 4 + 2 + 2 + 4 + sizeof(double) + 4 + 4 + 4;
+    static const size_t blockInfoSize = 8 + 4 + 4;
+
+    template <typename T>
+    static void put(uint8_t *&dst, const T &value) {
+        memcpy(dst, &value, sizeof(T));
+        dst += sizeof(T);
+    }
+
+    template <typename T>
+    static T get(const uint8_t *src, size_t srcSize, size_t &pos) {
+        if (pos + sizeof(T) > srcSize) {
+            throw runtime_error("Compressed buffer is truncated.");
+        }
+        T value;
+        memcpy(&value, src + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    size_t dataTypeSize(DataType dtype) {
+        switch (dtype) {
+        case float32:
+            return sizeof(float);
+        case float64:
+            return sizeof(double);
+        case int16:
+            return sizeof(int16_t);
+        default:
+            return sizeof(int32_t);
+        }
+    }
+
+    uint64_t ContainerHeader::count() const {
+        uint64_t n = 1;
+        for (const uint64_t &dim : dims) {
+            n *= dim;
+        }
+        return n;
+    }
+
+    uint64_t ContainerHeader::blockCount(size_t i) const {
+        const uint64_t begin = (uint64_t)i * blockSize;
+        return min<uint64_t>(blockSize, count() - begin);
+    }
+
+    size_t containerHeaderSize(size_t ndims, size_t numBlocks) {
+        return fixedHeaderSize + ndims * sizeof(uint64_t) + numBlocks * blockInfoSize;
+    }
+
+    size_t ContainerHeader::size() const {
+        return containerHeaderSize(dims.size(), blocks.size());
+    }
+
+    void writeContainerHeader(const ContainerHeader &header, uint8_t *dst) {
+        uint8_t *start = dst;
+        memcpy(dst, containerMagic, sizeof(containerMagic));
+        dst += sizeof(containerMagic);
+        put(dst, header.version);
+        put(dst, header.flags);
+        put(dst, (uint8_t)header.dtype);
+        put(dst, (uint8_t)header.predictor);
+        put(dst, (uint8_t)header.coder);
+        put(dst, (uint8_t)header.dims.size());
+        for (const uint64_t &dim : header.dims) {
+            put(dst, dim);
+        }
+        put(dst, header.maxError);
+        put(dst, header.blockSize);
+        put(dst, (uint32_t)header.blocks.size());
+        for (const BlockInfo &block : header.blocks) {
+            put(dst, block.offset);
+            put(dst, block.size);
+            put(dst, block.checksum);
+        }
+        put(dst, xxhash32(start, dst - start));
+    }
+
+    size_t readContainerHeader(const uint8_t *src, size_t srcSize, ContainerHeader &header) {
+        if (srcSize < sizeof(containerMagic) || memcmp(src, containerMagic, sizeof(containerMagic)) != 0) {
+            throw runtime_error("Not an SDRH container.");
+        }
+        size_t pos = sizeof(containerMagic);
+        header.version = get<uint16_t>(src, srcSize, pos);
+        if (header.version != containerVersion) {
+            throw runtime_error("Unsupported container version.");
+        }
+        header.flags = get<uint16_t>(src, srcSize, pos);
+        header.dtype = (DataType)get<uint8_t>(src, srcSize, pos);
+        header.predictor = (ExtrapolationMethod)get<uint8_t>(src, srcSize, pos);
+        header.coder = (EntropyCoder)get<uint8_t>(src, srcSize, pos);
+        const uint8_t ndims = get<uint8_t>(src, srcSize, pos);
+        const uint16_t knownFlags = pointwiseRelativeFlag | fixedRateFlag | progressiveFlag | tableReuseFlag;
+        if ((header.flags & ~knownFlags) != 0 || header.dtype > int32 || header.predictor > regression ||
+            header.coder > huffmanZstdCoder || ndims == 0 || ndims > maxDims) {
+            throw runtime_error("Container header is corrupt.");
+        }
+        // Only Huffman-coded blocks can be fixed-rate, progressive or reference tables
+        if (header.coder != huffmanCoder && (header.flags & (fixedRateFlag | progressiveFlag | tableReuseFlag))) {
+            throw runtime_error("Container header is corrupt.");
+        }
+
+        header.dims.resize(ndims);
+        for (uint64_t &dim : header.dims) {
+            dim = get<uint64_t>(src, srcSize, pos);
+        }
+        header.maxError = get<double>(src, srcSize, pos);
+        header.blockSize = get<uint32_t>(src, srcSize, pos);
+        const uint32_t numBlocks = get<uint32_t>(src, srcSize, pos);
+        if (numBlocks > (srcSize - pos) / blockInfoSize) {
+            throw runtime_error("Compressed buffer is truncated.");
+        }
+
+        header.blocks.resize(numBlocks);
+        for (BlockInfo &block : header.blocks) {
+            block.offset = get<uint64_t>(src, srcSize, pos);
+            block.size = get<uint32_t>(src, srcSize, pos);
+            block.checksum = get<uint32_t>(src, srcSize, pos);
+        }
+
+        const uint32_t checksum = xxhash32(src, pos);
+        if (get<uint32_t>(src, srcSize, pos) != checksum) {
+            throw runtime_error("Container header checksum mismatch.");
+        }
+
+        const uint64_t count = header.count();
+        const uint64_t expectedBlocks = header.blockSize == 0 ? 0 : (count + header.blockSize - 1) / header.blockSize;
+        if (numBlocks != expectedBlocks || (count > 0 && header.blockSize == 0)) {
+            throw runtime_error("Container header is corrupt.");
+        }
+        for (const BlockInfo &block : header.blocks) {
+            if (block.offset + block.size > srcSize - pos) {
+                throw runtime_error("Compressed buffer is truncated.");
+            }
+        }
+        return pos;
+    }
+
+}
@@ -0,0 +1,146 @@
+#include "dictionary.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "checksum.h"
+
+namespace sdrhuff {
+
+    template <typename T>
+    static void writeValue(vector<uint8_t> &out, const T &value) {
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    template <typename T>
+    static T readValue(const uint8_t *src, size_t srcSize, size_t &pos) {
+        if (pos + sizeof(T) > srcSize) {
+            throw runtime_error("Dictionary is truncated.");
+        }
+        T value;
+        memcpy(&value, src + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    void buildDictionary(HuffmanDictionary &dictionary) {
+        HuffmanCode &code = dictionary.code;
+        unsigned long long lengthCounts[maxDictionaryCodeLength + 1] = {};
+        size_t symbols = 0;
+        for (const uint8_t &length : code.lengths) {
+            if (length > maxDictionaryCodeLength) {
+                throw runtime_error("Dictionary is corrupt.");
+            }
+            lengthCounts[length]++;
+            symbols += length > 0;
+        }
+        lengthCounts[0] = 0;
+
+        // The codewords must fill the code space exactly, or the decoding tree
+        // would have missing branches. A single symbol gets a 1-bit codeword.
+        if (symbols == 1) {
+            if (lengthCounts[1] != 1) {
+                throw runtime_error("Dictionary is corrupt.");
+            }
+        } else {
+            unsigned long long available = 1;
+            for (int length = 1; length <= maxDictionaryCodeLength; ++length) {
+                available *= 2;
+                if (lengthCounts[length] > available) {
+                    throw runtime_error("Dictionary is corrupt.");
+                }
+                available -= lengthCounts[length];
+                // Every open branch needs at least one more symbol
+                if (available > symbols) {
+                    throw runtime_error("Dictionary is corrupt.");
+                }
+            }
+            if (symbols == 0 || available != 0) {
+                throw runtime_error("Dictionary is corrupt.");
+            }
+        }
+
+        // Canonical codewords: shorter codes first, then by value
+        unsigned long long nextCode[maxDictionaryCodeLength + 1] = {};
+        unsigned long long next = 0;
+        for (int length = 1; length <= maxDictionaryCodeLength; ++length) {
+            next = (next + lengthCounts[length - 1]) << 1;
+            nextCode[length] = next;
+        }
+
+        // The decoder reads the first bit from the LSB, so codewords are reversed
+        code.bits.assign(code.lengths.size(), 0);
+        dictionary.nodes.reset(2 * symbols - 1);
+        Node *root = dictionary.nodes.create(0, 0);
+        for (size_t i = 0; i < code.lengths.size(); ++i) {
+            const int length = code.lengths[i];
+            if (length == 0) {
+                continue;
+            }
+            const unsigned long long codeword = nextCode[length]++;
+            uint64_t reversed = 0;
+            for (int bit = 0; bit < length; ++bit) {
+                reversed |= ((codeword >> (length - 1 - bit)) & 1) << bit;
+            }
+            code.bits[i] = reversed;
+
+            if (symbols == 1) {
+                root->value = code.minValue + (int)i;
+                continue;
+            }
+            Node *node = root;
+            for (int bit = 0; bit < length; ++bit) {
+                Node *&child = (reversed >> bit) & 1 ? node->right : node->left;
+                if (!child) {
+                    child = dictionary.nodes.create(0, 0);
+                }
+                node = child;
+            }
+            node->value = code.minValue + (int)i;
+        }
+        dictionary.tree = root;
+        dictionary.id = xxhash32(code.lengths.data(), code.lengths.size(), (uint32_t)code.minValue);
+    }
+
+    void writeDictionary(const HuffmanDictionary &dictionary, vector<uint8_t> &out) {
+        const size_t start = out.size();
+        out.insert(out.end(), dictionaryMagic, dictionaryMagic + sizeof(dictionaryMagic));
+        writeValue(out, dictionaryVersion);
+        writeValue(out, dictionary.id);
+        writeValue(out, (int32_t)dictionary.code.minValue);
+        writeValue(out, (uint32_t)dictionary.code.lengths.size());
+        out.insert(out.end(), dictionary.code.lengths.begin(), dictionary.code.lengths.end());
+        writeValue(out, xxhash32(out.data() + start, out.size() - start));
+    }
+
+    void readDictionary(const uint8_t *src, size_t srcSize, HuffmanDictionary &dictionary) {
+        if (srcSize < sizeof(dictionaryMagic) || memcmp(src, dictionaryMagic, sizeof(dictionaryMagic)) != 0) {
+            throw runtime_error("Not an SDRH dictionary.");
+        }
+        size_t pos = sizeof(dictionaryMagic);
+        if (readValue<uint16_t>(src, srcSize, pos) != dictionaryVersion) {
+            throw runtime_error("Unsupported dictionary version.");
+        }
+        const uint32_t id = readValue<uint32_t>(src, srcSize, pos);
+        const int32_t minValue = readValue<int32_t>(src, srcSize, pos);
+        const uint32_t numCodes = readValue<uint32_t>(src, srcSize, pos);
+        if (numCodes > srcSize - pos) {
+            throw runtime_error("Dictionary is truncated.");
+        }
+        const uint8_t *lengths = src + pos;
+        pos += numCodes;
+        const uint32_t checksum = xxhash32(src, pos);
+        if (readValue<uint32_t>(src, srcSize, pos) != checksum) {
+            throw runtime_error("Dictionary checksum mismatch.");
+        }
+
+        dictionary.code.minValue = minValue;
+        dictionary.code.lengths.assign(lengths, lengths + numCodes);
+        buildDictionary(dictionary);
+        if (dictionary.id != id) {
+            throw runtime_error("Dictionary is corrupt.");
+        }
+    }
+
+}
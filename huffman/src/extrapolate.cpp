@@ -1,34 +1,16 @@
 #include "extrapolate.h"
 
-int maxLookback = 3; // Maximum number of data points to consider for extrapolation
-
-float extrapolateNext(vector<float> &data, int index, const ExtrapolationMethod &method) {
-    if (method == none || index < 1) {
-        return data[0];
-    } else if (method == piecewise || index < 2) {
-        return data[index - 1];
-    } else if (method == linear || index < 3) {
-        return 2 * data[index - 1] - data[index - 2];
-    } else if (method == quadratic) {
-        return data[index - 3] - 3 * data[index - 2] + 3 * data[index - 1];
-    } else if (method == regression) {
-        // Perform linear regression
-        int n = min(index - 1, maxLookback);
-        float sumX = 0, sumY = 0, sumXY = 0, sumX2 = 0;
-        for (int i = index - n; i < index; i++) {
-            sumX += i;
-            sumY += data[i];
-            sumXY += i * data[i];
-            sumX2 += i * i;
-        }
-        float slope = (n * sumXY - sumX * sumY) / (n * sumX2 - sumX * sumX);
-        float intercept = (sumY - slope * sumX) / n;
-        float result = slope * index + intercept;
-        if (isnan(result)) {
-            return 2 * data[index - 1] - data[index - 2]; // Default to linear extrapolation
-        }
-        return result;
-    } else {
-        throw runtime_error("Unknown extrapolation method.");
+template <typename T>
+T extrapolateNext(const T *data, int index, const ExtrapolationMethod &method) {
+    ExtrapolationHistory<T> history;
+    history.first = data[0];
+    for (int i = 0; i < maxLookback; ++i) {
+        history.previous[i] = index - 1 - i >= 0 ? data[index - 1 - i] : data[0];
     }
-}
\ No newline at end of file
+    return withExtrapolationMethod(method, [&](auto m) {
+        return extrapolate<decltype(m)::value>(history, index);
+    });
+}
+
+template float extrapolateNext<float>(const float *, int, const ExtrapolationMethod &);
+template double extrapolateNext<double>(const double *, int, const ExtrapolationMethod &);
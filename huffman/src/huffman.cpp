@@ -1,237 +1,266 @@
 #include "huffman.h"
 
-Node *createNode(int value, unsigned freq) {
-    Node *node = new Node();
-    node->value = value;
-    node->freq = freq;
-    node->left = node->right = NULL;
-    return node;
+#include <algorithm>
+#include <limits>
+
+void NodePool::reset(size_t capacity) {
+    nodes.clear();
+    // Nodes are handed out by pointer, so the storage must never move while a tree is alive
+    nodes.reserve(capacity);
+}
+
+Node *NodePool::create(int value, unsigned freq) {
+    if (nodes.size() == nodes.capacity()) {
+        return nullptr;
+    }
+    nodes.push_back({freq, value, nullptr, nullptr});
+    return &nodes.back();
+}
+
+void Histogram::reset() {
+    if (counts.empty()) {
+        minValue = -128;
+        counts.resize(256);
+    }
+    fill(counts.begin(), counts.end(), 0);
+}
+
+void Histogram::grow(int value) {
+    if (counts.empty()) {
+        reset();
+    }
+    // At least double the window so repeated outliers grow it only logarithmically often
+    long long newMin = min<long long>(minValue, value);
+    long long newMax = max<long long>(maxValue(), value);
+    const long long size = counts.size();
+    if (value < minValue) {
+        newMin = min(newMin, newMax - 2 * size + 1);
+    } else {
+        newMax = max(newMax, newMin + 2 * size - 1);
+    }
+    newMin = max<long long>(newMin, numeric_limits<int>::min());
+    newMax = min<long long>(newMax, numeric_limits<int>::max());
+
+    vector<unsigned> grown(newMax - newMin + 1, 0);
+    copy(counts.begin(), counts.end(), grown.begin() + (minValue - newMin));
+    counts.swap(grown);
+    minValue = newMin;
 }
 
-void generateCode(Node *cur, string path, unordered_map<int, string> &code) {
+void countFrequencies(const vector<int> &vec, Histogram &histogram) {
+    histogram.reset();
+    for (const int &i : vec) {
+        histogram.add(i);
+    }
+}
+
+static void generateCode(Node *cur, uint64_t path, int depth, HuffmanCode &code) {
     if (cur->left) {
-        generateCode(cur->left, path + '0', code);
+        generateCode(cur->left, path, depth + 1, code);
     }
     if (cur->right) {
-        generateCode(cur->right, path + '1', code);
+        generateCode(cur->right, path | (1ULL << depth), depth + 1, code);
     }
     if (!cur->left && !cur->right) {
-        code[cur->value] = path;
+        code.bits[cur->value - code.minValue] = path;
+        code.lengths[cur->value - code.minValue] = depth;
     }
 }
 
-unordered_map<int, string> getHuffmanCode(Node *huffmanTree) {
-    unordered_map<int, string> code;
+void getHuffmanCode(Node *huffmanTree, int minValue, int maxValue, HuffmanCode &code) {
+    code.minValue = minValue;
+    code.bits.assign((long long)maxValue - minValue + 1, 0);
+    code.lengths.assign((long long)maxValue - minValue + 1, 0);
     if (!huffmanTree->left && !huffmanTree->right) {
         // Only one unique character
-        code[huffmanTree->value] = "0";
-        return code;
+        code.lengths[huffmanTree->value - minValue] = 1;
+        return;
     }
-    generateCode(huffmanTree, "", code);
-    return code;
+    generateCode(huffmanTree, 0, 0, code);
 }
 
 bool CompareNode::operator()(const Node *lhs, const Node *rhs) const {
     return lhs->freq > rhs->freq;
 }
 
-Node *generateHuffmanTree(const unordered_map<int, unsigned> &freqMap) {
-    if (freqMap.empty()) {
-        cerr << "freqMap has size 0\n";
+Node *generateHuffmanTree(const Histogram &histogram, NodePool &pool, vector<Node *> &heap) {
+    size_t symbols = 0;
+    for (const unsigned &count : histogram.counts) {
+        symbols += count > 0;
+    }
+    if (symbols == 0) {
+        cerr << "histogram is empty\n";
         return nullptr;
     }
 
-    priority_queue<Node *, vector<Node *>, CompareNode> heap;
+    // A tree with k leaves has 2k - 1 nodes
+    pool.reset(2 * symbols - 1);
+    heap.clear();
 
-    for (const auto &pair : freqMap) {
-        heap.push(createNode(pair.first, pair.second));
+    for (size_t i = 0; i < histogram.counts.size(); ++i) {
+        if (histogram.counts[i] > 0) {
+            heap.push_back(pool.create(histogram.minValue + i, histogram.counts[i]));
+        }
     }
+    make_heap(heap.begin(), heap.end(), CompareNode());
 
     while (heap.size() > 1) {
-        Node *first = heap.top();
-        heap.pop();
-        Node *second = heap.top();
-        heap.pop();
-
-        Node *newNode = createNode(0, first->freq + second->freq);
+        pop_heap(heap.begin(), heap.end(), CompareNode());
+        Node *first = heap.back();
+        heap.pop_back();
+        pop_heap(heap.begin(), heap.end(), CompareNode());
+        Node *second = heap.back();
+        heap.pop_back();
+
+        Node *newNode = pool.create(0, first->freq + second->freq);
         newNode->left = first;
         newNode->right = second;
 
-        heap.push(newNode);
+        heap.push_back(newNode);
+        push_heap(heap.begin(), heap.end(), CompareNode());
     }
 
-    return heap.empty() ? nullptr : heap.top();
+    return heap.front();
 }
 
-pair<vector<uint8_t>, unsigned long long> encode(const vector<int> &vec, const unordered_map<int, string> &code) {
-    vector<uint8_t> res;
-    uint8_t byte = 0;
-    int bitPos = 0;
-    unsigned long long totalBits = 0;
-    for (const int &i : vec) {
-        const string &bits = code.at(i);
-        for (const char &bit : bits) {
-            byte = (byte >> 1) | ((bit - '0') << 7);
-
-            if (++bitPos == 8) {
-                res.push_back(byte);
-                byte = 0;
-                bitPos = 0;
+template <typename CodeT>
+void encode(const CodeT *values, size_t count, const int *outliers, const HuffmanCode &code,
+            BitWriter &writer) {
+    const int escape = escapeCode<CodeT>();
+    for (size_t i = 0; i < count; ++i) {
+        const int index = values[i] - code.minValue;
+        writer.write(code.bits[index], code.lengths[index]);
+        if (values[i] == escape) {
+            const int outlier = *outliers++;
+            writer.write((uint32_t)outlier, 32);
+            if (outlier == exactMarker) {
+                writer.write((uint32_t)*outliers++, 32);
+                writer.write((uint32_t)*outliers++, 32);
             }
         }
     }
-    totalBits += res.size() * 8;
-    if (bitPos > 0) {
-        res.push_back(byte >> (8 - bitPos));
-        totalBits += bitPos;
-    }
+}
 
-    return {res, totalBits};
+// Reads the escaped value following an escape codeword, and the exact sample
+// after an exactMarker
+static inline void readOutlier(BitReader &reader, vector<int> &outliers) {
+    const int outlier = (int)reader.readBits(32);
+    outliers.push_back(outlier);
+    if (outlier == exactMarker) {
+        outliers.push_back((int)reader.readBits(32));
+        outliers.push_back((int)reader.readBits(32));
+    }
 }
 
-vector<int> decode(const string &str, Node *huffmanTree) {
-    vector<int> result;
+template <typename CodeT>
+void decode(BitReader &reader, Node *huffmanTree, CodeT *out, size_t count, vector<int> &outliers) {
+    const int escape = escapeCode<CodeT>();
+    outliers.clear();
 
     if (!huffmanTree->left && !huffmanTree->right) {
-        // Only one unique character
-        for (const char &c : str) {
-            result.push_back(huffmanTree->value);
+        // Only one unique character, stored as one bit per symbol
+        for (size_t i = 0; i < count; ++i) {
+            reader.readBit();
+            out[i] = huffmanTree->value;
+            if (huffmanTree->value == escape) {
+                readOutlier(reader, outliers);
+            }
         }
-        return result;
+        return;
     }
 
-    Node *root = huffmanTree;
-    Node *node = root;
+    // Fast path: bounds are checked once per symbol since a codeword takes at
+    // most 64 bits and escaped values are read with checked reads, and the
+    // child is picked by index instead of a branch
+    const uint8_t *data = reader.data;
+    unsigned long long pos = reader.pos;
+    const unsigned long long safeEnd = reader.totalBits > 96 ? reader.totalBits - 96 : 0;
+    size_t i = 0;
+    Node *node = huffmanTree;
+    while (i < count && pos < safeEnd) {
+        const unsigned bit = (data[pos >> 3] >> (pos & 7)) & 1;
+        node = (&node->left)[bit];
+        ++pos;
+        if (!node->left) {
+            out[i++] = node->value;
+            if (node->value == escape) {
+                reader.pos = pos;
+                readOutlier(reader, outliers);
+                pos = reader.pos;
+            }
+            node = huffmanTree;
+        }
+    }
+    reader.pos = pos;
 
-    for (const char &c : str) {
-        if (c == '0') {
-            node = node->left;
-        } else {
-            node = node->right;
+    // Finish the symbol in progress and the rest of the stream with checked reads
+    for (; i < count; ++i) {
+        while (node->left) {
+            node = reader.readBit() ? node->right : node->left;
         }
-        if (!node->left && !node->right) {
-            result.push_back(node->value);
-            node = root;
+        out[i] = node->value;
+        if (node->value == escape) {
+            readOutlier(reader, outliers);
         }
+        node = huffmanTree;
     }
-
-    return result;
 }
 
-void traverseTree(Node *cur, string &out) {
+template void encode<int8_t>(const int8_t *, size_t, const int *, const HuffmanCode &, BitWriter &);
+template void encode<int16_t>(const int16_t *, size_t, const int *, const HuffmanCode &, BitWriter &);
+template void encode<int32_t>(const int32_t *, size_t, const int *, const HuffmanCode &, BitWriter &);
+template void decode<int8_t>(BitReader &, Node *, int8_t *, size_t, vector<int> &);
+template void decode<int16_t>(BitReader &, Node *, int16_t *, size_t, vector<int> &);
+template void decode<int32_t>(BitReader &, Node *, int32_t *, size_t, vector<int> &);
+
+// Pre-order traversal: '0' for an internal node, '1' followed by the 32-bit
+// value (most significant bit first) for a leaf
+void serializeTree(Node *cur, BitWriter &writer) {
     if (!cur->left && !cur->right) {
-        out.push_back('1');
-        int c = cur->value;
+        writer.write(1, 1);
+        unsigned c = cur->value;
         const int numBits = sizeof(c) * 8;
         for (int i = numBits - 1; i >= 0; --i) {
-            bool bit = (c >> i) & 1;
-            out.push_back(bit ? '1' : '0');
+            writer.write((c >> i) & 1, 1);
         }
     } else {
-        out.push_back('0');
-        traverseTree(cur->left, out);
-        traverseTree(cur->right, out);
+        writer.write(0, 1);
+        serializeTree(cur->left, writer);
+        serializeTree(cur->right, writer);
     }
 }
 
-string serializeTree(Node *tree) {
-    string out;
-    traverseTree(tree, out);
-    return out;
-}
+static Node *deserialize(BitReader &reader, NodePool &pool, int depth, int minValue, int maxValue) {
+    // Codewords are at most 64 bits long
+    if (depth > 64) {
+        throw runtime_error("Serialized tree is too deep.");
+    }
+    bool b = reader.readBit();
 
-Node *deserialize(const string &serializedTree, int &i) {
-    while (i < serializedTree.length()) {
-        // Read bit
-        bool b = serializedTree.at(i) == '1';
-
-        if (b) {
-            int cur = 0;
-            int numBits = sizeof(cur) * 8;
-            for (int pos = numBits - 1; pos >= 0; pos--) {
-                ++i;
-                b = serializedTree.at(i) == '1';
-                if (b) {
-                    cur |= (1 << pos);
-                }
+    Node *newNode = pool.create(0, 0);
+    if (!newNode) {
+        throw runtime_error("Serialized tree has too many nodes.");
+    }
+    if (b) {
+        unsigned cur = 0;
+        int numBits = sizeof(cur) * 8;
+        for (int pos = numBits - 1; pos >= 0; pos--) {
+            if (reader.readBit()) {
+                cur |= (1U << pos);
             }
-            Node *newNode = createNode(cur, 0);
-            return newNode;
-        } else {
-            Node *newNode = createNode(0, 0);
-            newNode->left = deserialize(serializedTree, ++i);
-            newNode->right = deserialize(serializedTree, ++i);
-            return newNode;
         }
-    }
-    return NULL;
-}
-
-Node *deserializeTree(const string &serializedTree) {
-    int i = 0;
-    return deserialize(serializedTree, i);
-}
-
-/**
- * Writes a string of bits to a file.
- * 
- * @param out The output file stream to write to.
- * @param bits The string of bits to write.
- *
- * @details This function writes a string of bits to a file in little-endian format.
- *          The bits are packed into bytes, with the least significant bit (LSB) of each byte
- *          corresponding to the first bit in the string. The last byte may not be fully filled
- *          if the number of bits is not a multiple of 8. In this case, the remaining bits are
- *          stored in the most significant bits (MSB) of the last byte, while the least significant
- *          bits are set to 0.
- */
-void writeBitsToFile(ofstream &out, const string &bits) {
-    vector<uint8_t> res;
-    uint8_t byte = 0;
-    int bitPos = 0;
-    unsigned long long totalBits = 0;
-
-    for (const char &bit : bits) {
-        byte = (byte >> 1) | ((bit - '0') << 7);
-
-        if (++bitPos == 8) {
-            res.push_back(byte);
-            byte = 0;
-            bitPos = 0;
+        // Narrowed into the code type, a larger value could pose as the escape code
+        newNode->value = cur;
+        if (newNode->value < minValue || newNode->value > maxValue) {
+            throw runtime_error("Serialized tree has a value out of range.");
         }
+    } else {
+        newNode->left = deserialize(reader, pool, depth + 1, minValue, maxValue);
+        newNode->right = deserialize(reader, pool, depth + 1, minValue, maxValue);
     }
-
-    totalBits += res.size() * 8;
-    if (bitPos > 0) {
-        res.push_back(byte >> (8 - bitPos));
-        totalBits += bitPos;
-    }
-
-    out.write(reinterpret_cast<const char*>(res.data()), res.size());
+    return newNode;
 }
 
-string readBitsIntoString(ifstream &file, unsigned long long bits) {
-    char byte;
-    stringstream stream;
-    while (bits >= 8) {
-        file.read(&byte, sizeof(byte));
-
-        // Add this to the string
-        for (int pos = 0; pos < 8; ++pos) {
-            bool b = byte & (1 << pos);
-            stream << (b ? '1' : '0');
-        }
-
-        bits -= 8;
-    }
-    if (bits > 0) {
-        file.read(&byte, sizeof(byte));
-
-        // Add this to the string
-        for (int pos = 0; pos < bits; ++pos) {
-            bool b = byte & (1 << pos);
-            stream << (b ? '1' : '0');
-        }
-    }
-    return stream.str();
-}
\ No newline at end of file
+Node *deserializeTree(BitReader &reader, NodePool &pool, int minValue, int maxValue) {
+    return deserialize(reader, pool, 0, minValue, maxValue);
+}
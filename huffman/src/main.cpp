@@ -13,41 +13,41 @@
 #include <queue>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include "extrapolate.h"
 #include "huffman.h"
+#include "pipeline.h"
+#include "sdrhuff.h"
 
 using namespace std;
 namespace fs = filesystem;
 
-void readFloats(const string &inputPath, vector<float> &inputFloats) {
+// Reads a raw array of T (float, double, int16_t or int32_t)
+template <typename T>
+void readValues(const string &inputPath, vector<T> &inputValues) {
     ifstream file(inputPath, ios::binary | ios::ate);
     if (!file) {
         cerr << "Failed to open the file.\n";
+        inputValues.clear();
         return;
     }
 
     auto size = file.tellg();
     file.seekg(0, std::ios::beg);
 
-    size_t numFloats = size / sizeof(float);
-    inputFloats.reserve(numFloats);
+    size_t numValues = size / sizeof(T);
+    inputValues.resize(numValues);
 
-    std::vector<float> buffer(numFloats);
-    if (file.read(reinterpret_cast<char *>(buffer.data()),
-                  numFloats * sizeof(float))) {
-        inputFloats.insert(inputFloats.end(), buffer.begin(), buffer.end());
-    } else {
+    if (!file.read(reinterpret_cast<char *>(inputValues.data()),
+                   numValues * sizeof(T))) {
         cerr << "Error reading the file.\n";
+        inputValues.clear();
     }
 }
 
-enum ErrorMode {
-    absolute,
-    relative
-};
 float getAbsAverage(const std::vector<float> &vec) {
     if (vec.empty()) {
         return 0.0f; // Handle empty vector case
@@ -61,184 +61,113 @@ float getAbsAverage(const std::vector<float> &vec) {
     return sum / vec.size();
 }
 
-void compressFile(const string &inputPath, const string &outputPath,
-                  const float &error, const ErrorMode &errorMode,
-                  const ExtrapolationMethod &extrapolationMethod, const bool debugMode) {
-    vector<float> inputFloats;
-    readFloats(inputPath, inputFloats);
-
-    const long long n = inputFloats.size();
-    if (n < 2) {
-        cerr << "File contains fewer than two data points.\n";
+void readBytes(const string &inputPath, vector<uint8_t> &bytes) {
+    ifstream file(inputPath, ios::binary | ios::ate);
+    if (!file) {
+        cerr << "Failed to open the file.\n";
+        bytes.clear();
         return;
     }
 
-    float minFloat = std::numeric_limits<float>::max();
-    float maxFloat = std::numeric_limits<float>::lowest();
-
-    for (float f : inputFloats) {
-        if (f < minFloat)
-            minFloat = f;
-        if (f > maxFloat)
-            maxFloat = f;
-    }
-
-    float range = maxFloat - minFloat;
-
-    float maxError;
-    // Calculate absolute error
-    if (errorMode == absolute) {
-        maxError = error;
-    } else {
-        maxError = range * error;
-    }
+    auto size = file.tellg();
+    file.seekg(0, std::ios::beg);
 
-    if (abs(maxError) < 1.0E-15F) {
-        cout << "WARNING! Max error has extremely small magnitude: " << maxError
-             << "\n";
+    bytes.resize(size);
+    if (!file.read(reinterpret_cast<char *>(bytes.data()), size)) {
+        cerr << "Error reading the file.\n";
+        bytes.clear();
     }
+}
 
-    vector<float> extrapolateErrors(n - 2); // Size n-2
-    vector<float> lossyData(n);             // Size n
-    lossyData[0] = inputFloats[0];
-    lossyData[1] = inputFloats[1];
+// Buffers shared by consecutive compressFile/decompressFile calls
+template <typename T>
+struct FileCodec {
+    sdrhuff::CompressionContext compressionContext;
+    sdrhuff::DecompressionContext decompressionContext;
+    vector<T> values;
+    vector<uint8_t> bytes;
+    // Pre-trained table that blocks may reference, or nullptr
+    const sdrhuff::HuffmanDictionary *dictionary = nullptr;
+};
 
-    ofstream extrapErrorsFile;
-    if (debugMode) {
-        extrapErrorsFile.open(outputPath + "-extrap-errors.txt");
+// The bound recorded in the header, which the library derives from the target in
+// relative and PSNR modes, can be too small to be meaningful
+void warnIfTinyBound(const sdrhuff::CompressionContext &ctx) {
+    if (abs(ctx.header.maxError) < 1.0E-15) {
+        cerr << "WARNING! Max error has extremely small magnitude: " << ctx.header.maxError << "\n";
     }
+}
 
-    // Extrapolation step
-    for (size_t i = 2; i < inputFloats.size(); ++i) {
-        const float extrapolatedFloat =
-            extrapolateNext(lossyData, i, extrapolationMethod);
-        const float err = inputFloats[i] - extrapolatedFloat;
-        extrapolateErrors[i - 2] = err;
-
-        if (debugMode && extrapErrorsFile.is_open()) {
-            extrapErrorsFile << err << "\n";
-        }
-
-        // Figure out what err would quantize to
-        float quantizedErr = round(err / (2 * maxError)) * 2 * maxError;
-        lossyData[i] = extrapolatedFloat + quantizedErr;
-    }
+template <typename T>
+void compressFile(const string &inputPath, const string &outputPath,
+                  const double &error, const ErrorMode &errorMode,
+                  const ExtrapolationMethod &extrapolationMethod, const int levels,
+                  const sdrhuff::EntropyCoder coder, const bool debugMode, FileCodec<T> &codec) {
+    vector<T> &inputValues = codec.values;
+    readValues(inputPath, inputValues);
 
-    if (debugMode && extrapErrorsFile.is_open()) {
-        extrapErrorsFile.close();
+    if (inputValues.size() < 2) {
+        cerr << "File contains fewer than two data points.\n";
+        return;
     }
 
-    vector<int> inputInts; // Size n-2
-    unordered_map<int, unsigned> freqMap;
-    ofstream quantizationLevelsFile;
+    sdrhuff::CompressionParams params;
+    params.error = error;
+    params.errorMode = errorMode;
+    params.extrapolationMethod = extrapolationMethod;
+    params.levels = levels;
+    params.coder = coder;
+    params.dictionary = codec.dictionary;
     if (debugMode) {
-        quantizationLevelsFile.open(outputPath + "-quantization-levels.txt");
+        params.debugPrefix = outputPath;
     }
-    // Split into buckets of size 2 * maxError, where bucket 0 is centered at 0
-    for (const auto &err : extrapolateErrors) {
-        int bucket = round(err / (2 * maxError));
-        inputInts.push_back(bucket);
-        freqMap[bucket]++;
 
-        if (debugMode && quantizationLevelsFile.is_open()) {
-            quantizationLevelsFile << bucket << "\n";
-        }
-    }
-    if (debugMode && quantizationLevelsFile.is_open()) {
-        quantizationLevelsFile.close();
-    }
-
-    Node *tree = generateHuffmanTree(freqMap);
-    unordered_map<int, string> code = getHuffmanCode(tree);
-
-    pair<vector<uint8_t>, unsigned long long> encodedRes = encode(inputInts, code);
-    vector<uint8_t> encoded = encodedRes.first;
-    string buffer = serializeTree(tree);
-    unsigned bufferSize =
-        buffer.length(); // Get number of bits needed to store the tree
-    unsigned long long encodedSize = encodedRes.second;
+    vector<uint8_t> &compressed = codec.bytes;
+    sdrhuff::compress(codec.compressionContext, inputValues.data(), inputValues.size(),
+                      params, compressed);
+    warnIfTinyBound(codec.compressionContext);
 
     // Write the compressed file
     ofstream out(outputPath, ios::binary | ios::out);
-
-    // 4 + 4 bytes to store first two data points
-    out.write(reinterpret_cast<char *>(&inputFloats[0]), sizeof(maxError));
-    out.write(reinterpret_cast<char *>(&inputFloats[1]), sizeof(maxError));
-
-    // 4 bytes to store maxError
-    out.write(reinterpret_cast<const char *>(&maxError), sizeof(maxError));
-
-    // 4 + 8 bytes to store bufferSize and encodedSize
-    out.write(reinterpret_cast<char *>(&bufferSize), sizeof(bufferSize));
-    out.write(reinterpret_cast<char *>(&encodedSize), sizeof(encodedSize));
-
-    writeBitsToFile(out, buffer);
-    //writeBitsToFile(out, encoded);
-    out.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
-
+    out.write(reinterpret_cast<const char *>(compressed.data()), compressed.size());
     out.close();
 }
 
-void decompressFile(const string &inputPath, const string &outputPath,
-                    const ExtrapolationMethod &extrapolationMethod) {
-    auto startTotal = chrono::high_resolution_clock::now();
-    ifstream compressed(inputPath, ios::binary);
+// With previewLevels > 0, a progressive file is decoded only up to that level,
+// giving a downsampled field (see sdrhuff::decompressPreview)
+template <typename T>
+void decompressFile(const string &inputPath, const string &outputPath, FileCodec<T> &codec,
+                    const int previewLevels = 0) {
+    vector<uint8_t> &compressed = codec.bytes;
+    readBytes(inputPath, compressed);
 
-    if (!compressed.is_open()) {
+    if (compressed.empty()) {
         cerr << "File could not be opened.\n";
         return;
     }
 
-    float maxError;
-    float x0, x1;
-    vector<float> reconstructedData;
-    unsigned bufferSize;
-    unsigned long long encodedSize;
-
-    compressed.read(reinterpret_cast<char *>(&x0), sizeof(x0));
-    compressed.read(reinterpret_cast<char *>(&x1), sizeof(x1));
-    reconstructedData.push_back(x0);
-    reconstructedData.push_back(x1);
-
-    compressed.read(reinterpret_cast<char *>(&maxError), sizeof(maxError));
-
-    compressed.read(reinterpret_cast<char *>(&bufferSize), sizeof(bufferSize));
-    compressed.read(reinterpret_cast<char *>(&encodedSize), sizeof(encodedSize));
-
-    string serializedTree = readBitsIntoString(compressed, bufferSize);
-    string encodedData = readBitsIntoString(compressed, encodedSize);
-
-    compressed.close();
+    vector<T> &reconstructedData = codec.values;
+    codec.decompressionContext.dictionary = codec.dictionary;
+    if (previewLevels > 0) {
+        reconstructedData.resize(
+            sdrhuff::getPreviewSize(compressed.data(), compressed.size(), previewLevels));
+        sdrhuff::decompressPreview(codec.decompressionContext, compressed.data(), compressed.size(),
+                                   previewLevels, reconstructedData.data(), reconstructedData.size());
+    } else {
+        sdrhuff::decompress(codec.decompressionContext, compressed.data(), compressed.size(),
+                            reconstructedData);
+    }
 
-    Node *deserializedTree = deserializeTree(serializedTree);
-    vector<int> decodedInts = decode(encodedData, deserializedTree);
     ofstream decodedFile(outputPath, ios::binary | ios::out);
     if (!decodedFile) {
         cerr << "Error creating the file.\n";
         return;
     }
 
-    // Reconstruction step
-    for (size_t i = 0; i < decodedInts.size(); ++i) {
-        // Convert the bucket number back to float
-        const float decodedErr = decodedInts[i] * 2 * maxError;
-
-        // Extrapolate the new data point and adjust for error
-        const float extrapolatedFloat =
-            extrapolateNext(reconstructedData, i + 2, extrapolationMethod);
-        const float reconstructedFloat = extrapolatedFloat + decodedErr;
-        reconstructedData.push_back(reconstructedFloat);
-    }
-
     // Write reconstructed data to file
-    for (const auto &f : reconstructedData) {
-        decodedFile.write(reinterpret_cast<const char *>(&f), sizeof(f));
-    }
+    decodedFile.write(reinterpret_cast<const char *>(reconstructedData.data()),
+                      reconstructedData.size() * sizeof(T));
     decodedFile.close();
-    auto endTotal = chrono::high_resolution_clock::now();
-    auto durationTotal =
-        chrono::duration_cast<chrono::microseconds>(endTotal - startTotal);
-    // cout << "Decoding time: " << durationTotal.count() << " microseconds.\n";
 }
 
 size_t getFileSize(const string &filePath) {
@@ -276,35 +205,34 @@ void outputErrors(const string &filePath1, const string &filePath2,
     out.close();
 }
 
-pair<float, float> getMaxAndAvgError(const string &filePath1,
-                                     const string &filePath2) {
-    ifstream file1(filePath1, ios::binary);
-    ifstream file2(filePath2, ios::binary);
-
-    if (!file1.is_open() || !file2.is_open()) {
-        throw runtime_error("Files could not be opened.");
-    }
-
-    float v1, v2;
-    float maxError = 0.0f;
-    int count = 0;
-    float sumError = 0.0f;
-    while (file1.read(reinterpret_cast<char *>(&v1), sizeof(v1))) {
-        file2.read(reinterpret_cast<char *>(&v2), sizeof(v2));
-        float curError = abs(v2 - v1);
-        maxError = max(maxError, curError);
-
-        sumError += curError;
-        count++;
+void writeFile(const fs::path &outputPath, const void *data, size_t size) {
+    ofstream out(outputPath, ios::binary | ios::out);
+    if (!out) {
+        cerr << "Error creating the file.\n";
+        return;
     }
+    out.write(reinterpret_cast<const char *>(data), size);
+}
 
-    float avgError = sumError / count;
+// Files in flight between pipeline stages
+const size_t pipelineDepth = 2;
 
-    file1.close();
-    file2.close();
+// An input file prefetched by the reader thread
+template <typename T>
+struct LoadedFile {
+    string filename;
+    size_t originalSize = 0;
+    vector<T> values;
+};
 
-    return make_pair(maxError, avgError);
-}
+// Outputs of one file, written by the writer thread
+template <typename T>
+struct FileResult {
+    fs::path compressedPath;
+    fs::path outputPath;
+    vector<uint8_t> compressed;
+    vector<T> decompressed;
+};
 
 string getCurrentTimeFormatted() {
     time_t t = time(nullptr);
@@ -318,10 +246,13 @@ string getCurrentTimeFormatted() {
     return string(buffer);
 }
 
-void compressDataset(const fs::path &datasetDirectory, float maxError,
+template <typename T>
+void compressDataset(const fs::path &datasetDirectory, double maxError,
                      const ErrorMode &errorMode, const string &errorModeName,
                      const ExtrapolationMethod &extrapolationMethod,
-                     const string &methodName, const bool debugMode) {
+                     const string &methodName, const int levels, const sdrhuff::EntropyCoder coder,
+                     const string &coderName, const bool reuseTables,
+                     const sdrhuff::HuffmanDictionary *dictionary, const bool debugMode) {
     vector<string> testCases;
 
     fs::path outputDir = "out" / datasetDirectory;
@@ -337,6 +268,8 @@ void compressDataset(const fs::path &datasetDirectory, float maxError,
     size_t datasetSize = 0;
     size_t compressedDatasetSize = 0;
     float totalCompressionTime = 0.0f;
+    double datasetMaxError = 0.0;
+    size_t totalViolations = 0;
 
     // Dataset compression log
     string compressionLogName = "compression-" + methodName + "-" +
@@ -347,60 +280,131 @@ void compressDataset(const fs::path &datasetDirectory, float maxError,
         throw runtime_error("File could not be opened");
     }
 
-    for (string filename : testCases) {
-        fs::path inputPath = datasetDirectory / filename;
-        fs::path compressedPath = outputDir / (filename + "-compressed.bin");
-        fs::path outputPath = outputDir / (filename + "-decompressed.bin");
-
-        auto c0 = chrono::high_resolution_clock::now();
-        compressFile(inputPath, compressedPath, maxError, errorMode,
-                     extrapolationMethod, debugMode);
-        auto c1 = chrono::high_resolution_clock::now();
-        decompressFile(compressedPath, outputPath, extrapolationMethod);
-        auto c2 = chrono::high_resolution_clock::now();
-
-        // Get time in ms
-        auto compressionTime =
-            chrono::duration_cast<chrono::microseconds>(c1 - c0).count() / 1000.0f;
-        auto decompressionTime =
-            chrono::duration_cast<chrono::microseconds>(c2 - c1).count() / 1000.0f;
-
-        size_t originalSize = getFileSize(inputPath);
-        size_t compressedSize = getFileSize(compressedPath);
-
-        fs::path errorsPath = outputDir / (filename + "-errors.txt");
-        // outputErrors(inputPath, outputPath, errorsPath);
-
-        pair<float, float> maxAndAvgError =
-            getMaxAndAvgError(inputPath, outputPath);
-        float curMaxError = maxAndAvgError.first;
-        float curAvgError = maxAndAvgError.second;
-
-        cout << "Compressed " << filename << "...\n";
-
-        compressionLog << "Compressed " << filename << ":\n";
-        compressionLog << "- Max error: " << curMaxError << "\n";
-        compressionLog << "- Avg error: " << curAvgError << "\n";
-        compressionLog << "- Original file size: " << originalSize << " B\n";
-        compressionLog << "- Compressed file size: " << compressedSize << " B\n";
-        compressionLog << "- Compression..."
-                       << "\n";
-        compressionLog << "-   ratio: " << (float)originalSize / compressedSize
-                       << "\n";
-        compressionLog << "-   time: " << compressionTime << " ms\n";
-        compressionLog << "-   throughput: "
-                       << (float)originalSize / compressionTime << " KB/s\n";
-        compressionLog << "- Decompression..."
-                       << "\n";
-        compressionLog << "-   time: " << decompressionTime << " ms\n";
-        compressionLog << "-   throughput: "
-                       << (float)originalSize / decompressionTime << " KB/s\n";
-
-        // Update running totals for the entire dataset
-        datasetSize += originalSize;
-        compressedDatasetSize += compressedSize;
-        totalCompressionTime += compressionTime;
+    sdrhuff::CompressionParams params;
+    params.error = maxError;
+    params.errorMode = errorMode;
+    params.extrapolationMethod = extrapolationMethod;
+    params.levels = levels;
+    params.coder = coder;
+    params.reuseTables = reuseTables;
+    params.dictionary = dictionary;
+
+    // Three stage pipeline: the reader thread prefetches input files, this thread
+    // compresses and decompresses them in memory, and the writer thread stores
+    // the results. Bounded queues cap the number of files held in memory.
+    BoundedQueue<LoadedFile<T>> loaded(pipelineDepth);
+    BoundedQueue<FileResult<T>> results(pipelineDepth);
+
+    thread reader([&] {
+        for (const string &filename : testCases) {
+            LoadedFile<T> file;
+            file.filename = filename;
+            file.originalSize = getFileSize(datasetDirectory / filename);
+            readValues(datasetDirectory / filename, file.values);
+            if (!loaded.push(std::move(file))) {
+                break;
+            }
+        }
+        loaded.close();
+    });
+
+    thread writer([&] {
+        FileResult<T> result;
+        while (results.pop(result)) {
+            writeFile(result.compressedPath, result.compressed.data(), result.compressed.size());
+            writeFile(result.outputPath, result.decompressed.data(),
+                      result.decompressed.size() * sizeof(T));
+        }
+    });
+
+    auto stopPipeline = [&] {
+        loaded.close();
+        results.close();
+        reader.join();
+        writer.join();
+    };
+
+    FileCodec<T> codec;
+    codec.decompressionContext.dictionary = dictionary;
+    auto wallStart = chrono::high_resolution_clock::now();
+    try {
+        LoadedFile<T> file;
+        while (loaded.pop(file)) {
+            const string &filename = file.filename;
+            if (file.values.size() < 2) {
+                cerr << "File contains fewer than two data points.\n";
+                continue;
+            }
+            if (debugMode) {
+                params.debugPrefix = (outputDir / (filename + "-compressed.bin")).string();
+            }
+
+            FileResult<T> result;
+            result.compressedPath = outputDir / (filename + "-compressed.bin");
+            result.outputPath = outputDir / (filename + "-decompressed.bin");
+
+            auto c0 = chrono::high_resolution_clock::now();
+            sdrhuff::compress(codec.compressionContext, file.values.data(), file.values.size(),
+                              params, result.compressed);
+            auto c1 = chrono::high_resolution_clock::now();
+            warnIfTinyBound(codec.compressionContext);
+            // Verified against the original while decoding, no need to read the files back
+            sdrhuff::ErrorStats errors;
+            sdrhuff::decompressAndVerify(codec.decompressionContext, result.compressed.data(),
+                                         result.compressed.size(), file.values.data(),
+                                         result.decompressed, errors);
+            auto c2 = chrono::high_resolution_clock::now();
+
+            // Get time in ms
+            auto compressionTime =
+                chrono::duration_cast<chrono::microseconds>(c1 - c0).count() / 1000.0f;
+            auto decompressionTime =
+                chrono::duration_cast<chrono::microseconds>(c2 - c1).count() / 1000.0f;
+
+            size_t originalSize = file.originalSize;
+            size_t compressedSize = result.compressed.size();
+
+            results.push(std::move(result));
+
+            cout << "Compressed " << filename << "...\n";
+
+            compressionLog << "Compressed " << filename << ":\n";
+            compressionLog << "- Max error: " << errors.maxError << "\n";
+            compressionLog << "- Avg error: " << errors.meanError() << "\n";
+            compressionLog << "- RMSE: " << errors.rmse() << "\n";
+            compressionLog << "- PSNR: " << errors.psnr() << " dB\n";
+            compressionLog << "- Bound violations: " << errors.violations << "\n";
+            compressionLog << "- Original file size: " << originalSize << " B\n";
+            compressionLog << "- Compressed file size: " << compressedSize << " B\n";
+            compressionLog << "- Compression..."
+                           << "\n";
+            compressionLog << "-   ratio: " << (float)originalSize / compressedSize
+                           << "\n";
+            compressionLog << "-   time: " << compressionTime << " ms\n";
+            compressionLog << "-   throughput: "
+                           << (float)originalSize / compressionTime << " KB/s\n";
+            compressionLog << "- Decompression..."
+                           << "\n";
+            compressionLog << "-   time: " << decompressionTime << " ms\n";
+            compressionLog << "-   throughput: "
+                           << (float)originalSize / decompressionTime << " KB/s\n";
+
+            // Update running totals for the entire dataset
+            datasetSize += originalSize;
+            compressedDatasetSize += compressedSize;
+            totalCompressionTime += compressionTime;
+            datasetMaxError = max(datasetMaxError, errors.maxError);
+            totalViolations += errors.violations;
+        }
+    } catch (...) {
+        stopPipeline();
+        throw;
     }
+    // Wait for the last writes before reporting
+    stopPipeline();
+    auto wallEnd = chrono::high_resolution_clock::now();
+    float wallTime =
+        chrono::duration_cast<chrono::microseconds>(wallEnd - wallStart).count() / 1000.0f;
 
     cout << "FINISHED! Summary:\n";
 
@@ -409,11 +413,16 @@ void compressDataset(const fs::path &datasetDirectory, float maxError,
     cout << "- Compression time: " << totalCompressionTime << " ms\n";
     cout << "METRICS:\n";
     cout << "- Extrapolation method: " << methodName << "\n";
+    cout << "- Entropy coder: " << coderName << "\n";
     cout << "- Max error: " << maxError << " " << errorModeName << "\n";
+    cout << "- Observed max error: " << datasetMaxError << "\n";
+    cout << "- Bound violations: " << totalViolations << "\n";
     cout << "- Overall compression ratio: "
          << (float)datasetSize / compressedDatasetSize << "\n";
     cout << "- Overall throughput: " << (float)datasetSize / totalCompressionTime
          << " KB/s\n";
+    cout << "- End-to-end throughput (read, compress, decompress, write): "
+         << (float)datasetSize / wallTime << " KB/s\n";
 
     compressionLog << "FINISHED! Summary:\n";
 
@@ -423,11 +432,16 @@ void compressDataset(const fs::path &datasetDirectory, float maxError,
     compressionLog << "- Compression time: " << totalCompressionTime << " ms\n";
     compressionLog << "METRICS:\n";
     compressionLog << "- Extrapolation method: " << methodName << "\n";
+    compressionLog << "- Entropy coder: " << coderName << "\n";
     compressionLog << "- Max error: " << maxError << " " << errorModeName << "\n";
+    compressionLog << "- Observed max error: " << datasetMaxError << "\n";
+    compressionLog << "- Bound violations: " << totalViolations << "\n";
     compressionLog << "- Overall compression ratio: "
                    << (float)datasetSize / compressedDatasetSize << "\n";
     compressionLog << "- Overall throughput: "
                    << (float)datasetSize / totalCompressionTime << " KB/s\n";
+    compressionLog << "- End-to-end throughput (read, compress, decompress, write): "
+                   << (float)datasetSize / wallTime << " KB/s\n";
     if (debugMode) {
         compressionLog << "WARNING: DEBUG MODE WAS ON\n";
     }
@@ -435,25 +449,249 @@ void compressDataset(const fs::path &datasetDirectory, float maxError,
     compressionLog.close();
 }
 
-int main() {
+void loadDictionary(const string &path, sdrhuff::HuffmanDictionary &dictionary) {
+    vector<uint8_t> bytes;
+    readBytes(path, bytes);
+    sdrhuff::readDictionary(bytes.data(), bytes.size(), dictionary);
+}
+
+// Calls f(T()) for the element type of the given data type
+template <typename F>
+void withDataType(sdrhuff::DataType dataType, F &&f) {
+    switch (dataType) {
+    case sdrhuff::float32:
+        return f(float());
+    case sdrhuff::float64:
+        return f(double());
+    case sdrhuff::int16:
+        return f(int16_t());
+    case sdrhuff::int32:
+        return f(int32_t());
+    }
+}
+
+// Trains a dictionary on the quantization codes of all files and writes it
+template <typename T>
+void trainDictionaryFile(const string &dictionaryPath, const double &error, const ErrorMode &errorMode,
+                     const ExtrapolationMethod &extrapolationMethod, const vector<string> &files) {
+    sdrhuff::CompressionParams params;
+    params.error = error;
+    params.errorMode = errorMode;
+    params.extrapolationMethod = extrapolationMethod;
+
+    sdrhuff::CompressionContext ctx;
+    sdrhuff::HuffmanDictionary dictionary;
+    vector<T> values;
+    for (const string &file : files) {
+        readValues(file, values);
+        if (!values.empty()) {
+            sdrhuff::trainDictionary(ctx, values.data(), values.size(), params, dictionary);
+        }
+    }
+    if (!dictionary.tree) {
+        throw runtime_error("No data to train the dictionary on.");
+    }
+
+    vector<uint8_t> bytes;
+    sdrhuff::writeDictionary(dictionary, bytes);
+    ofstream out(dictionaryPath, ios::binary | ios::out);
+    out.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+
+    cout << "Trained dictionary " << hex << dictionary.id << dec << " with "
+         << dictionary.code.lengths.size() << " codes on " << files.size() << " files\n";
+}
+
+vector<string> splitList(const string &list) {
+    vector<string> items;
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ',')) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+// Prints the estimated compressibility of the files for every combination of
+// error and method, without encoding or writing anything
+template <typename T>
+void analyzeFiles(const ErrorMode &errorMode, const vector<double> &errors,
+                  const vector<pair<string, ExtrapolationMethod>> &methods,
+                  const vector<string> &files) {
+    vector<vector<T>> inputs(files.size());
+    size_t totalSize = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        readValues(files[i], inputs[i]);
+        totalSize += inputs[i].size() * sizeof(T);
+    }
+
+    sdrhuff::CompressionContext ctx;
+    cout << left << setw(12) << "method" << setw(12) << "error" << setw(14) << "bits/code"
+         << setw(16) << "expected size" << setw(10) << "ratio" << "throughput\n";
+    for (const auto &method : methods) {
+        for (const double &error : errors) {
+            sdrhuff::CompressionParams params;
+            params.error = error;
+            params.errorMode = errorMode;
+            params.extrapolationMethod = method.second;
+
+            // Entropy is averaged over all codes of all files
+            double bits = 0;
+            size_t codes = 0;
+            size_t expectedSize = 0;
+            auto start = chrono::high_resolution_clock::now();
+            for (const vector<T> &values : inputs) {
+                if (values.size() < 2) {
+                    continue;
+                }
+                sdrhuff::CompressionEstimate estimate =
+                    sdrhuff::estimate(ctx, values.data(), values.size(), params);
+                bits += estimate.entropy * (values.size() - 2);
+                codes += values.size() - 2;
+                expectedSize += estimate.size;
+            }
+            auto end = chrono::high_resolution_clock::now();
+            float time = chrono::duration_cast<chrono::microseconds>(end - start).count() / 1000.0f;
+
+            cout << left << setw(12) << method.first << setw(12) << error << setw(14)
+                 << (codes > 0 ? bits / codes : 0) << setw(16) << expectedSize << setw(10)
+                 << (float)totalSize / expectedSize << (float)totalSize / time << " KB/s\n";
+        }
+    }
+}
+
+// Without arguments, runs the interactive dataset benchmark. Otherwise:
+//   huffman train <dictionary> <type> <error mode> <error> <method> <files...>
+//   huffman compress <type> <error mode> <error> <method> <input> <output> [--levels n] [coder] [dictionary]
+//   huffman decompress <type> <input> <output> [--preview levels] [dictionary]
+//   huffman analyze <type> <error mode> <errors> <methods|all> <files...>
+// where errors and methods are comma-separated lists, and coder is huffman (the
+// default), zstd or huffman+zstd. Files compressed with a dictionary can only be decompressed with the same one,
+// which the compressed blocks reference by its id. --preview decodes only the
+// first levels of a progressive file, one compressed with --levels, giving a
+// downsampled field.
+int main(int argc, char *argv[]) {
     static unordered_map<string, ErrorMode> const errorModeNames = {
-        {"absolute", absolute}, {"relative", relative}};
+        {"absolute", absolute}, {"relative", relative},
+        {"pointwise", pointwise}, {"psnr", psnr}, {"fixedrate", fixedRate}};
     static unordered_map<string, ExtrapolationMethod> const methodNames = {
         {"linear", linear},
         {"piecewise", piecewise},
         {"none", none},
         {"quadratic", quadratic},
         {"regression", regression}};
+    static unordered_map<string, sdrhuff::DataType> const dataTypeNames = {
+        {"float", sdrhuff::float32},
+        {"double", sdrhuff::float64},
+        {"int16", sdrhuff::int16},
+        {"int32", sdrhuff::int32}};
+    static unordered_map<string, sdrhuff::EntropyCoder> const coderNames = {
+        {"huffman", sdrhuff::huffmanCoder},
+        {"zstd", sdrhuff::zstdCoder},
+        {"huffman+zstd", sdrhuff::huffmanZstdCoder}};
+
+    auto find = [](const auto &names, const string &name, const char *what) {
+        auto it = names.find(name);
+        if (it == names.end()) {
+            throw runtime_error(string("Invalid ") + what);
+        }
+        return it->second;
+    };
+
+    const vector<string> args(argv + 1, argv + argc);
+    if (!args.empty()) {
+        const string &command = args[0];
+        if (command == "train" && args.size() >= 7) {
+            const vector<string> files(args.begin() + 6, args.end());
+            withDataType(find(dataTypeNames, args[2], "data type"), [&](auto tag) {
+                trainDictionaryFile<decltype(tag)>(args[1], stod(args[4]),
+                                               find(errorModeNames, args[3], "error mode"),
+                                               find(methodNames, args[5], "extrapolation method"),
+                                               files);
+            });
+        } else if (command == "compress" && args.size() >= 7 && args.size() <= 11) {
+            // The optional arguments are told apart by the coder names
+            sdrhuff::EntropyCoder coder = sdrhuff::huffmanCoder;
+            string dictionaryPath;
+            int levels = 0;
+            for (size_t i = 7; i < args.size(); ++i) {
+                if (args[i] == "--levels" && i + 1 < args.size()) {
+                    levels = stoi(args[++i]);
+                } else if (coderNames.count(args[i])) {
+                    coder = coderNames.at(args[i]);
+                } else {
+                    dictionaryPath = args[i];
+                }
+            }
+            withDataType(find(dataTypeNames, args[1], "data type"), [&](auto tag) {
+                FileCodec<decltype(tag)> codec;
+                sdrhuff::HuffmanDictionary dictionary;
+                if (!dictionaryPath.empty()) {
+                    loadDictionary(dictionaryPath, dictionary);
+                    codec.dictionary = &dictionary;
+                }
+                compressFile(args[5], args[6], stod(args[3]),
+                             find(errorModeNames, args[2], "error mode"),
+                             find(methodNames, args[4], "extrapolation method"), levels, coder, false,
+                             codec);
+            });
+        } else if (command == "decompress" && args.size() >= 4 && args.size() <= 7) {
+            int previewLevels = 0;
+            string dictionaryPath;
+            for (size_t i = 4; i < args.size(); ++i) {
+                if (args[i] == "--preview" && i + 1 < args.size()) {
+                    previewLevels = stoi(args[++i]);
+                    if (previewLevels <= 0) {
+                        throw runtime_error("Invalid preview level");
+                    }
+                } else {
+                    dictionaryPath = args[i];
+                }
+            }
+            withDataType(find(dataTypeNames, args[1], "data type"), [&](auto tag) {
+                FileCodec<decltype(tag)> codec;
+                sdrhuff::HuffmanDictionary dictionary;
+                if (!dictionaryPath.empty()) {
+                    loadDictionary(dictionaryPath, dictionary);
+                    codec.dictionary = &dictionary;
+                }
+                decompressFile(args[2], args[3], codec, previewLevels);
+            });
+        } else if (command == "analyze" && args.size() >= 6) {
+            vector<double> errors;
+            for (const string &error : splitList(args[3])) {
+                errors.push_back(stod(error));
+            }
+            vector<pair<string, ExtrapolationMethod>> methods;
+            const string methodList =
+                args[4] == "all" ? "linear,piecewise,quadratic,none,regression" : args[4];
+            for (const string &method : splitList(methodList)) {
+                methods.emplace_back(method, find(methodNames, method, "extrapolation method"));
+            }
+            const vector<string> files(args.begin() + 5, args.end());
+            withDataType(find(dataTypeNames, args[1], "data type"), [&](auto tag) {
+                analyzeFiles<decltype(tag)>(find(errorModeNames, args[2], "error mode"), errors,
+                                            methods, files);
+            });
+        } else {
+            cerr << "Usage:\n"
+                 << "  huffman train <dictionary> <type> <error mode> <error> <method> <files...>\n"
+                 << "  huffman compress <type> <error mode> <error> <method> <input> <output> [--levels n] [coder] [dictionary]\n"
+                 << "  huffman decompress <type> <input> <output> [--preview levels] [dictionary]\n"
+                 << "  huffman analyze <type> <error mode> <errors> <methods|all> <files...>\n";
+            return 1;
+        }
+        return 0;
+    }
 
     vector<fs::path> datasets = {"real-datasets/CESM-ATM", "real-datasets/EXAALT",
                                  "real-datasets/ISABEL"};
-    vector<float> errors = {1E-2, 1E-3, 1E-4, 1E-5, 1E-6};
+    vector<double> errors = {1E-2, 1E-3, 1E-4, 1E-5, 1E-6};
     vector<string> methods = {"none", "regression"};
 
     for (const fs::path &dataset : datasets) {
-        for (const float &error : errors) {
+        for (const double &error : errors) {
             for (const string &method : methods) {
-                // compressDataset(dataset, error, relative, "relative",
+                // compressDataset<float>(dataset, error, relative, "relative",
                 // methodNames.at(method), method);
             }
         }
@@ -466,8 +704,22 @@ int main() {
     std::cout << "Enter dataset directory to test: ";
     std::cin >> testDir;
 
+    std::string inputDataType;
+    std::cout << "Enter data type (float, double, int16, int32): ";
+    std::cin >> inputDataType;
+
+    // Parse the data type
+
+    sdrhuff::DataType dataType;
+    auto itType = dataTypeNames.find(inputDataType);
+    if (itType != dataTypeNames.end()) {
+        dataType = itType->second;
+    } else {
+        throw runtime_error("Invalid data type");
+    }
+
     std::string inputErrorMode;
-    std::cout << "Enter error mode (absolute, relative): ";
+    std::cout << "Enter error mode (absolute, relative, pointwise, psnr, fixedrate): ";
     std::cin >> inputErrorMode;
 
     // Parse the error mode
@@ -480,11 +732,17 @@ int main() {
         throw runtime_error("Invalid error mode");
     }
     
-    float maxError;
+    double maxError;
     if (errorMode == absolute) {
         std::cout << "Enter max absolute error: ";
     } else if (errorMode == relative) {
         std::cout << "Enter max relative error: ";
+    } else if (errorMode == pointwise) {
+        std::cout << "Enter max point-wise relative error: ";
+    } else if (errorMode == psnr) {
+        std::cout << "Enter target PSNR (dB): ";
+    } else if (errorMode == fixedRate) {
+        std::cout << "Enter bits per sample: ";
     }
     std::cin >> maxError;
 
@@ -502,6 +760,36 @@ int main() {
         throw runtime_error("Invalid extrapolation method");
     }
 
+    int levels;
+    std::cout << "Progressive levels (0 for none): ";
+    std::cin >> levels;
+
+    string inputCoder;
+    std::cout << "Entropy coder (huffman, zstd, huffman+zstd): ";
+    std::cin >> inputCoder;
+    sdrhuff::EntropyCoder coder;
+    auto itCoder = coderNames.find(inputCoder);
+    if (itCoder != coderNames.end()) {
+        coder = itCoder->second;
+    } else {
+        throw runtime_error("Invalid entropy coder");
+    }
+
+    string reuseTablesInput;
+    std::cout << "Reuse Huffman tables across blocks (y/n)? ";
+    std::cin >> reuseTablesInput;
+    bool reuseTables = reuseTablesInput == "y";
+
+    string dictionaryPath;
+    std::cout << "Huffman dictionary file (none to skip): ";
+    std::cin >> dictionaryPath;
+    sdrhuff::HuffmanDictionary dictionary;
+    if (dictionaryPath != "none") {
+        loadDictionary(dictionaryPath, dictionary);
+    }
+    const sdrhuff::HuffmanDictionary *sharedDictionary =
+        dictionaryPath != "none" ? &dictionary : nullptr;
+
     // Verify if user wants to continue
     string debugModeInput;
     std::cout << "Debug mode (y/n)? ";
@@ -519,8 +807,29 @@ int main() {
         return 0;
     }
 
-    compressDataset(testDir, maxError, errorMode, inputErrorMode,
-                    extrapolationMethod, inputMethod, debugMode);
+    // Each element type runs its own instantiation of the pipeline
+    switch (dataType) {
+    case sdrhuff::float32:
+        compressDataset<float>(testDir, maxError, errorMode, inputErrorMode,
+                               extrapolationMethod, inputMethod, levels, coder, inputCoder,
+                               reuseTables, sharedDictionary, debugMode);
+        break;
+    case sdrhuff::float64:
+        compressDataset<double>(testDir, maxError, errorMode, inputErrorMode,
+                                extrapolationMethod, inputMethod, levels, coder, inputCoder,
+                                reuseTables, sharedDictionary, debugMode);
+        break;
+    case sdrhuff::int16:
+        compressDataset<int16_t>(testDir, maxError, errorMode, inputErrorMode,
+                                 extrapolationMethod, inputMethod, levels, coder, inputCoder,
+                                 reuseTables, sharedDictionary, debugMode);
+        break;
+    case sdrhuff::int32:
+        compressDataset<int32_t>(testDir, maxError, errorMode, inputErrorMode,
+                                 extrapolationMethod, inputMethod, levels, coder, inputCoder,
+                                 reuseTables, sharedDictionary, debugMode);
+        break;
+    }
 
     return 0;
 }
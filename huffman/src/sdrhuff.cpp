@@ -0,0 +1,1828 @@
+#include "sdrhuff.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#ifdef SDRHUFF_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "checksum.h"
+#include "huffman.h"
+
+namespace sdrhuff {
+
+    // Block layout (see container.h for the header):
+    //   uint8_t codeWidth               bytes per quantization code (1 or 2)
+    //   T seeds[min(count, 2)]          first data points of the block, in the element type
+    //   unsigned bufferSize             number of bits in the serialized tree   } only when
+    //   unsigned long long encodedSize  number of bits in the encoded data      } count > 2
+    //   serialized tree, padded to a whole byte
+    //   encoded data, padded to a whole byte
+    // With tableReuseFlag, a block reusing a table has bufferSize 0 and stores
+    //   uint32_t table                  index of an earlier block whose tree to use, or dictionaryTable
+    //   uint32_t dictionaryId           HuffmanDictionary::id, only for dictionaryTable
+    // in place of the serialized tree.
+
+    // With zstdCoder, everything after the seeds is replaced by
+    //   uint32_t numOutliers
+    //   zstd frame of CodeT codes[count - 2] followed by int32 outliers[numOutliers]
+    // With huffmanZstdCoder, everything after the seeds (sizes, tree and encoded
+    // data) is stored as one zstd frame.
+
+    // In point-wise relative mode the block starts with
+    //   uint8_t hasNegatives
+    //   uint8_t signs[(count + 7) / 8]  bit i set when sample i is negative, only when hasNegatives
+    //   double zeroLog                  log2 magnitudes below this decode as 0
+    // followed by the layout above for the log2 magnitudes, stored as doubles
+
+    // In fixed-rate mode the block starts with
+    //   double maxError                 absolute error bound for this block
+    // followed by the layout above, then zero padding up to the block's budget
+
+    // In progressive mode the block holds L = numLevels residual layers, coarsest first:
+    //   uint8_t numLevels
+    //   T seed                          first data point of the block
+    //   uint32_t layerSizes[numLevels]  bytes per layer, 0 for a level without samples
+    //   per layer: unsigned bufferSize, unsigned long long encodedSize, tree, data
+    // Level 0 holds every 2^(L-1)-th sample, predicted from the previous one. Level j
+    // adds the samples halfway between those of the levels before it, interpolated
+    // from their neighbours, so the first k levels give every 2^(L-k)-th sample.
+
+    // Table reference to the dataset dictionary
+    static const uint32_t dictionaryTable = 0xFFFFFFFF;
+
+    // Number of leading samples used to pick the code width
+    static const size_t codeWidthProbeSize = 4096;
+
+    // The PSNR search quantizes up to psnrSampleBlocks evenly spaced runs of
+    // psnrSampleSize samples, and bisects the error psnrSearchSteps times
+    static const size_t psnrSampleBlocks = 8;
+    static const size_t psnrSampleSize = 1 << 16;
+    static const int psnrSearchSteps = 10;
+    // Number of times the PSNR bound is lowered before giving up on the target
+    static const int psnrCheckSteps = 32;
+
+    // The fixed-rate search scales the error down by 4 up to fixedRateSearchSteps
+    // times to bracket the budget, then bisects fixedRateRefineSteps times
+    static const int fixedRateSearchSteps = 16;
+    static const int fixedRateRefineSteps = 6;
+
+#ifdef SDRHUFF_HAVE_ZSTD
+    struct ZstdState {
+        ZSTD_CCtx *cctx = ZSTD_createCCtx();
+        ZSTD_DCtx *dctx = ZSTD_createDCtx();
+
+        ~ZstdState() {
+            ZSTD_freeCCtx(cctx);
+            ZSTD_freeDCtx(dctx);
+        }
+    };
+
+    bool zstdSupported() {
+        return true;
+    }
+
+    // Appends src as one zstd frame
+    static void zstdCompress(shared_ptr<ZstdState> &state, const uint8_t *src, size_t srcSize, int level,
+                             vector<uint8_t> &out) {
+        if (!state) {
+            state = make_shared<ZstdState>();
+        }
+        const size_t start = out.size();
+        out.resize(start + ZSTD_compressBound(srcSize));
+        const size_t size = ZSTD_compressCCtx(state->cctx, out.data() + start, out.size() - start, src,
+                                              srcSize, level);
+        if (ZSTD_isError(size)) {
+            throw runtime_error(string("zstd compression failed: ") + ZSTD_getErrorName(size));
+        }
+        out.resize(start + size);
+    }
+
+    // Decompresses the zstd frame in src into out, which is resized to the
+    // content size recorded in the frame, at most maxSize
+    static void zstdDecompress(shared_ptr<ZstdState> &state, const uint8_t *src, size_t srcSize,
+                               size_t maxSize, vector<uint8_t> &out) {
+        if (!state) {
+            state = make_shared<ZstdState>();
+        }
+        const unsigned long long contentSize = ZSTD_getFrameContentSize(src, srcSize);
+        if (contentSize == ZSTD_CONTENTSIZE_ERROR || contentSize == ZSTD_CONTENTSIZE_UNKNOWN ||
+            contentSize > maxSize) {
+            throw runtime_error("Compressed buffer is corrupt.");
+        }
+        out.resize(contentSize);
+        const size_t size = ZSTD_decompressDCtx(state->dctx, out.data(), out.size(), src, srcSize);
+        if (ZSTD_isError(size) || size != contentSize) {
+            throw runtime_error("Compressed buffer is corrupt.");
+        }
+    }
+#else
+    struct ZstdState {};
+
+    bool zstdSupported() {
+        return false;
+    }
+
+    static void zstdCompress(shared_ptr<ZstdState> &, const uint8_t *, size_t, int, vector<uint8_t> &) {
+        throw runtime_error("libsdrhuff was built without zstd.");
+    }
+
+    static void zstdDecompress(shared_ptr<ZstdState> &, const uint8_t *, size_t, size_t, vector<uint8_t> &) {
+        throw runtime_error("libsdrhuff was built without zstd.");
+    }
+#endif
+
+    template <typename T>
+    static void writeValue(vector<uint8_t> &out, const T &value) {
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    template <typename T>
+    static T readValue(const uint8_t *src, size_t srcSize, size_t &pos) {
+        if (pos + sizeof(T) > srcSize) {
+            throw runtime_error("Compressed buffer is truncated.");
+        }
+        T value;
+        memcpy(&value, src + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    // Whether `bits` bits, padded to whole bytes, fit in src[pos, srcSize). Sizes
+    // read from the buffer may be near the top of their range, so nothing is
+    // added to them.
+    static bool bitsFit(unsigned long long bits, size_t srcSize, size_t pos) {
+        return pos <= srcSize && bits / 8 + (bits % 8 != 0) <= srcSize - pos;
+    }
+
+    template <typename T>
+    static void patchValue(vector<uint8_t> &out, size_t pos, const T &value) {
+        memcpy(out.data() + pos, &value, sizeof(T));
+    }
+
+    static size_t blockBound(size_t count) {
+        // Seeds are sized for the widest element type, plus the point-wise relative
+        // prefix and the progressive layer table and per-layer headers and trees
+        size_t bound = sizeof(uint8_t) + min<size_t>(count, 2) * sizeof(double) +
+                       sizeof(uint8_t) + (count + 7) / 8 + sizeof(double) +
+                       maxLevels * (sizeof(uint32_t) + sizeof(unsigned) + sizeof(unsigned long long) + 5);
+        if (count <= 2) {
+            return bound;
+        }
+        const size_t symbols = count - 2;
+        // The tree has at most one leaf (33 bits) and one internal node (1 bit) per symbol
+        const size_t treeBits = 34 * symbols;
+        // Huffman coding never does worse than a fixed-length code, and each
+        // symbol may be an escape followed by 32 raw bits, or 96 for an exact sample
+        size_t codeLength = 1;
+        while ((1ULL << codeLength) < symbols) {
+            codeLength++;
+        }
+        const size_t huffmanBound = sizeof(unsigned) + sizeof(unsigned long long) +
+                                    (treeBits + 7) / 8 + (symbols * (codeLength + 96) + 7) / 8;
+        // The zstd coders store at most 2-byte codes plus three 4-byte outlier
+        // words per symbol, or the Huffman layout, and zstd expands its input by
+        // less than size / 128 + 64 bytes
+        const size_t zstdInput = max(sizeof(uint32_t) + symbols * 14, huffmanBound);
+        return bound + zstdInput + zstdInput / 128 + 64;
+    }
+
+    size_t compressBound(size_t n, uint32_t blockSize) {
+        const size_t numBlocks = (n + blockSize - 1) / blockSize;
+        size_t bound = containerHeaderSize(maxDims, numBlocks);
+        if (numBlocks > 0) {
+            bound += (numBlocks - 1) * blockBound(blockSize) + blockBound(n - (numBlocks - 1) * blockSize);
+        }
+        return bound;
+    }
+
+    // Per element type prediction and quantization rules. Floating-point data is
+    // predicted in double and quantized with a step of 2 * maxError; only the
+    // output is rounded to T.
+    template <typename T, bool = is_integral<T>::value>
+    struct Quantizer {
+        using Work = double;
+        double maxError;
+        Work step;
+
+        explicit Quantizer(double maxError) : maxError(maxError), step(2 * maxError) {}
+
+        Work predict(Work extrapolated) const {
+            return extrapolated;
+        }
+
+        // Split into buckets of size 2 * maxError, where bucket 0 is centered at 0.
+        // Residuals too large for an int saturate instead of overflowing.
+        int bucket(T value, Work predicted) const {
+            const Work bucket = round((value - predicted) / step);
+            return min<Work>(max<Work>(bucket, -numeric_limits<int>::max()), numeric_limits<int>::max());
+        }
+
+        Work reconstruct(Work predicted, int bucket) const {
+            return predicted + bucket * step;
+        }
+
+        // Rounding to T can still move the reconstruction past the bound, and
+        // saturated buckets miss it by far
+        bool accepts(T value, Work reconstructed) const {
+            return abs((double)(T)reconstructed - (double)value) <= maxError;
+        }
+    };
+
+    // Integers are predicted in double and rounded to the nearest representable
+    // value. The step is the odd integer 2 * floor(maxError) + 1, so reconstructions
+    // stay integral and maxError < 1 is lossless.
+    template <typename T>
+    struct Quantizer<T, true> {
+        using Work = double;
+        long long step;
+
+        explicit Quantizer(double maxError)
+            : step(2 * (long long)floor(min(max(maxError, 0.0), 4294967295.0)) + 1) {}
+
+        Work predict(Work extrapolated) const {
+            return clampToRange(nearbyint(extrapolated));
+        }
+
+        int bucket(T value, Work predicted) const {
+            const long long err = value - (long long)predicted;
+            if (step == 1) {
+                // Wraps around for int32_t residuals that do not fit in an int
+                return (int32_t)(uint32_t)err;
+            }
+            // Round to nearest, there are no ties since the step is odd
+            return err >= 0 ? (err + step / 2) / step : -((-err + step / 2) / step);
+        }
+
+        Work reconstruct(Work predicted, int bucket) const {
+            const long long value = (long long)predicted + bucket * step;
+            if (step == 1) {
+                return (int32_t)(uint32_t)value;
+            }
+            // Clamping only moves the value closer to the original sample
+            return clampToRange(value);
+        }
+
+        // Reconstructions are integral and within the bound by construction
+        bool accepts(T, Work) const {
+            return true;
+        }
+
+        static Work clampToRange(Work value) {
+            return min<Work>(max<Work>(value, numeric_limits<T>::min()), numeric_limits<T>::max());
+        }
+    };
+
+    static void checkFixedRate(double bitsPerSample) {
+        if (!(bitsPerSample >= minFixedRate && bitsPerSample <= maxFixedRate)) {
+            throw invalid_argument("Fixed-rate mode needs between 1 and 64 bits per sample.");
+        }
+    }
+
+    // Bytes of a fixed-rate block that do not depend on the rate: the block bound,
+    // code width and seeds (sized for double), then, past two samples, the tree
+    // and data sizes and the one-leaf tree that coding every residual as bucket 0
+    // needs. That tree codes each sample in 1 bit, so any rate of at least 1 bit
+    // per sample on top of this fits.
+    static size_t fixedRateOverhead(size_t count) {
+        size_t overhead = sizeof(double) + sizeof(uint8_t) + min<size_t>(count, 2) * sizeof(double);
+        if (count > 2) {
+            overhead += sizeof(unsigned) + sizeof(unsigned long long) + (33 + 7) / 8;
+        }
+        return overhead;
+    }
+
+    size_t fixedRateBlockBytes(size_t count, double bitsPerSample) {
+        checkFixedRate(bitsPerSample);
+        return fixedRateOverhead(count) + (size_t)ceil(count * bitsPerSample / 8);
+    }
+
+    size_t fixedRateSize(size_t n, double bitsPerSample, uint32_t blockSize, size_t ndims) {
+        const size_t numBlocks = (n + blockSize - 1) / blockSize;
+        size_t size = containerHeaderSize(ndims, numBlocks);
+        if (numBlocks > 0) {
+            size += (numBlocks - 1) * fixedRateBlockBytes(blockSize, bitsPerSample) +
+                    fixedRateBlockBytes(n - (numBlocks - 1) * blockSize, bitsPerSample);
+        }
+        return size;
+    }
+
+    // Stores a bucket at codes[k], escaping it if it does not fit in CodeT
+    template <typename CodeT>
+    static inline void storeCode(CodeT *codes, size_t k, int bucket, vector<int> &outliers,
+                                 Histogram &histogram) {
+        const int escape = escapeCode<CodeT>();
+        if (bucket > escape && bucket <= numeric_limits<CodeT>::max()) {
+            codes[k] = bucket;
+            histogram.add(bucket);
+        } else {
+            codes[k] = escape;
+            histogram.add(escape);
+            outliers.push_back(bucket);
+        }
+    }
+
+    // Stores a sample exactly: the escape code, then exactMarker and the sample
+    // as a double in the outliers (see huffman.h)
+    template <typename CodeT>
+    static inline void storeExact(CodeT *codes, size_t k, double value, vector<int> &outliers,
+                                  Histogram &histogram) {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        codes[k] = escapeCode<CodeT>();
+        histogram.add(escapeCode<CodeT>());
+        outliers.push_back(exactMarker);
+        outliers.push_back((int)(uint32_t)bits);
+        outliers.push_back((int)(uint32_t)(bits >> 32));
+    }
+
+    // Decoding counterpart of storeExact, reading the two words after the marker
+    static inline double readExact(const int *&outlier) {
+        const uint64_t bits = (uint64_t)(uint32_t)outlier[0] | (uint64_t)(uint32_t)outlier[1] << 32;
+        outlier += 2;
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // Quantizes one sample into codes[k] and returns what the decoder will
+    // reconstruct. Samples that no bucket reconstructs within the bound, and
+    // integer buckets that collide with exactMarker, are stored exactly.
+    template <typename T, typename CodeT>
+    static inline typename Quantizer<T>::Work
+    quantizeSample(const Quantizer<T> &quantizer, T value, typename Quantizer<T>::Work predicted, CodeT *codes,
+                   size_t k, vector<int> &outliers, Histogram &histogram, int &bucket) {
+        bucket = quantizer.bucket(value, predicted);
+        const typename Quantizer<T>::Work reconstructed = quantizer.reconstruct(predicted, bucket);
+        if (bucket == exactMarker || !quantizer.accepts(value, reconstructed)) {
+            storeExact(codes, k, (double)value, outliers, histogram);
+            return value;
+        }
+        storeCode(codes, k, bucket, outliers, histogram);
+        return reconstructed;
+    }
+
+    // Decoding counterpart of quantizeSample
+    template <typename T>
+    static inline typename Quantizer<T>::Work
+    reconstructSample(const Quantizer<T> &quantizer, typename Quantizer<T>::Work predicted, int bucket,
+                      const int *&outlier) {
+        if (bucket == exactMarker) {
+            return readExact(outlier);
+        }
+        return quantizer.reconstruct(predicted, bucket);
+    }
+
+    // Fused extrapolation, quantization and histogram pass. Each bucket is computed once,
+    // stored in codes and counted; only the few reconstructed values that the
+    // extrapolation looks back at are kept. Buckets that do not fit in CodeT are
+    // stored as the escape code and appended to outliers. When squaredError is
+    // given, the squared reconstruction errors are added to it.
+    template <ExtrapolationMethod method, typename T, typename CodeT>
+    static void quantize(const T *data, size_t n, const Quantizer<T> &quantizer, CodeT *codes,
+                         vector<int> &outliers, Histogram &histogram,
+                         ofstream *errorsLog, ofstream *levelsLog, double *squaredError = nullptr) {
+        using Work = typename Quantizer<T>::Work;
+        ExtrapolationHistory<Work> history = {(Work)data[0], {(Work)data[1], (Work)data[0], (Work)data[0]}};
+        histogram.reset();
+        outliers.clear();
+
+        for (size_t i = 2; i < n; ++i) {
+            const Work predicted = quantizer.predict(extrapolate<method>(history, i));
+            int bucket;
+            // Track what the decoder will reconstruct
+            const Work reconstructed = quantizeSample(quantizer, data[i], predicted, codes, i - 2, outliers,
+                                                      histogram, bucket);
+            history.push(reconstructed);
+
+            if (squaredError) {
+                const double err = (double)data[i] - (double)(T)reconstructed;
+                *squaredError += err * err;
+            }
+
+            if (errorsLog) {
+                *errorsLog << data[i] - predicted << "\n";
+                *levelsLog << bucket << "\n";
+            }
+        }
+    }
+
+    template <ExtrapolationMethod method, typename T, typename CodeT>
+    static void reconstruct(const CodeT *codes, size_t count, const vector<int> &outliers,
+                            const Quantizer<T> &quantizer, T *dst) {
+        using Work = typename Quantizer<T>::Work;
+        const int escape = escapeCode<CodeT>();
+        const int *outlier = outliers.data();
+        ExtrapolationHistory<Work> history = {(Work)dst[0], {(Work)dst[1], (Work)dst[0], (Work)dst[0]}};
+
+        for (size_t i = 0; i < count; ++i) {
+            const int bucket = codes[i] == escape ? *outlier++ : codes[i];
+
+            // Extrapolate the new data point and adjust for error
+            const Work predicted = quantizer.predict(extrapolate<method>(history, i + 2));
+            const Work reconstructed = reconstructSample(quantizer, predicted, bucket, outlier);
+            dst[i + 2] = reconstructed;
+            history.push(reconstructed);
+        }
+    }
+
+    // Number of samples in a level of the progressive hierarchy: level 0 holds
+    // multiples of the coarsest stride, finer levels the odd multiples of theirs
+    static size_t levelCount(size_t n, size_t stride, bool coarsest) {
+        const size_t step = coarsest ? stride : 2 * stride;
+        return n > stride ? (n - stride + step - 1) / step : 0;
+    }
+
+    // Predicts sample i from the decoded samples `stride` away: cubic where four
+    // neighbours exist, linear with two, the left one at the end of the block.
+    // values[j >> shift] holds sample j.
+    template <typename V>
+    static inline double interpolate(const V *values, size_t i, size_t stride, size_t n, int shift) {
+        auto at = [&](size_t j) { return (double)values[j >> shift]; };
+        if (i + stride >= n) {
+            return at(i - stride);
+        }
+        if (i >= 3 * stride && i + 3 * stride < n) {
+            return (-at(i - 3 * stride) + 9 * at(i - stride) + 9 * at(i + stride) - at(i + 3 * stride)) / 16;
+        }
+        return (at(i - stride) + at(i + stride)) / 2;
+    }
+
+    // Quantizes one level of the progressive hierarchy into ctx.codes16, keeping
+    // the reconstructed samples in reconstructed for the finer levels
+    template <typename T>
+    static size_t quantizeLevel(CompressionContext &ctx, const T *data, size_t n, size_t stride,
+                                bool coarsest, const Quantizer<T> &quantizer, double *reconstructed) {
+        using Work = typename Quantizer<T>::Work;
+        const size_t count = levelCount(n, stride, coarsest);
+        const size_t step = coarsest ? stride : 2 * stride;
+        ctx.codes16.resize(count);
+        ctx.histogram.reset();
+        ctx.outliers.clear();
+
+        size_t k = 0;
+        for (size_t i = stride; i < n; i += step, ++k) {
+            const double estimate = coarsest ? reconstructed[i - stride]
+                                             : interpolate(reconstructed, i, stride, n, 0);
+            const Work predicted = quantizer.predict((Work)estimate);
+            int bucket;
+            reconstructed[i] = (T)quantizeSample(quantizer, data[i], predicted, ctx.codes16.data(), k,
+                                                 ctx.outliers, ctx.histogram, bucket);
+        }
+        return count;
+    }
+
+    // Decoding counterpart of quantizeLevel. dst[j >> shift] receives sample j.
+    template <typename T>
+    static void reconstructLevel(const int16_t *codes, const vector<int> &outliers, size_t n,
+                                 size_t stride, bool coarsest, int shift,
+                                 const Quantizer<T> &quantizer, T *dst) {
+        using Work = typename Quantizer<T>::Work;
+        const int escape = escapeCode<int16_t>();
+        const int *outlier = outliers.data();
+        const size_t step = coarsest ? stride : 2 * stride;
+
+        size_t k = 0;
+        for (size_t i = stride; i < n; i += step, ++k) {
+            const int bucket = codes[k] == escape ? *outlier++ : codes[k];
+            const double estimate = coarsest ? (double)dst[(i - stride) >> shift]
+                                             : interpolate(dst, i, stride, n, shift);
+            const Work predicted = quantizer.predict((Work)estimate);
+            dst[i >> shift] = reconstructSample(quantizer, predicted, bucket, outlier);
+        }
+    }
+
+    // Picks 1-byte codes when the buckets of the first samples stay well within
+    // int8_t, leaving headroom so that later samples rarely need escaping
+    template <ExtrapolationMethod method, typename T>
+    static int probeCodeWidth(CompressionContext &ctx, const T *data, size_t n,
+                              const Quantizer<T> &quantizer) {
+        const size_t probeSize = min(n, codeWidthProbeSize);
+        ctx.codes16.resize(probeSize);
+        quantize<method>(data, probeSize, quantizer, ctx.codes16.data(), ctx.outliers,
+                         ctx.histogram, nullptr, nullptr);
+        if (!ctx.outliers.empty()) {
+            return 2;
+        }
+
+        const vector<unsigned> &counts = ctx.histogram.counts;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            const int value = ctx.histogram.minValue + (int)i;
+            if (counts[i] > 0 && abs(value) > numeric_limits<int8_t>::max() / 2) {
+                return 2;
+            }
+        }
+        return 1;
+    }
+
+    // Shannon entropy of the codes counted in the histogram times their number
+    static double entropyBits(const Histogram &histogram) {
+        double total = 0;
+        for (const unsigned &count : histogram.counts) {
+            total += count;
+        }
+        double bits = 0;
+        for (const unsigned &count : histogram.counts) {
+            if (count > 0) {
+                bits += count * log2(total / count);
+            }
+        }
+        return bits;
+    }
+
+    // Codeword length of value in code, 0 when it has none
+    static int codeLength(const HuffmanCode &code, int value) {
+        const unsigned long long index = (long long)value - code.minValue;
+        return index < code.lengths.size() ? code.lengths[index] : 0;
+    }
+
+    // Bits needed to encode the codes counted in the histogram with an existing
+    // table. Codes the table lacks take its escape codeword and 32 raw bits, and
+    // the cost is infinite when it has no escape codeword either.
+    static double tableCost(const Histogram &histogram, const HuffmanCode &code, int escape) {
+        const int escapeLength = codeLength(code, escape);
+        double bits = 0;
+        for (size_t i = 0; i < histogram.counts.size(); ++i) {
+            if (histogram.counts[i] == 0) {
+                continue;
+            }
+            int length = codeLength(code, histogram.minValue + (int)i);
+            if (length == 0) {
+                if (escapeLength == 0) {
+                    return numeric_limits<double>::infinity();
+                }
+                length = escapeLength + 32;
+            }
+            bits += (double)histogram.counts[i] * length;
+        }
+        return bits;
+    }
+
+    // Bits of a serialized tree: 33 per leaf and 1 per internal node
+    static unsigned long long treeBits(const NodePool &nodes) {
+        const unsigned long long leaves = (nodes.nodes.size() + 1) / 2;
+        return leaves * 33 + (leaves - 1);
+    }
+
+    // Bits rounded up to whole bytes, as the tree and data are padded
+    static double paddedBits(double bits) {
+        return ceil(bits / 8) * 8;
+    }
+
+    // Exact bits the block takes after its sizes when coded with `code`: the
+    // table (its padded serialized tree, or a reference) of tableBits, then the
+    // codes and the raw bits of the escaped values
+    static double blockBits(const CompressionContext &ctx, const HuffmanCode &code, int escape,
+                            double tableBits) {
+        return tableBits + paddedBits(tableCost(ctx.histogram, code, escape) + 32.0 * ctx.outliers.size());
+    }
+
+    // Builds the block's own tree and code into ctx.nodes and ctx.code. A table
+    // that later blocks may reuse gets a codeword for the escape code, through
+    // which they code the values it lacks.
+    static Node *buildBlockTable(CompressionContext &ctx, int escape) {
+        Histogram &histogram = ctx.histogram;
+        const bool addEscape = ctx.reuseTables && histogram.count(escape) == 0;
+        if (addEscape) {
+            histogram.add(escape);
+        }
+        Node *tree = generateHuffmanTree(histogram, ctx.nodes, ctx.heap);
+        getHuffmanCode(tree, histogram.minValue, histogram.maxValue(), ctx.code);
+        if (addEscape) {
+            histogram.counts[escape - histogram.minValue]--;
+        }
+        return tree;
+    }
+
+    // Exact bits the block takes after its sizes when it stores the table built
+    // by buildBlockTable. Sizing ahead of time and the choice of a table both
+    // use it, so that they agree with what encodeCodes writes.
+    static double ownTableBits(const CompressionContext &ctx, int escape) {
+        return blockBits(ctx, ctx.code, escape, paddedBits(treeBits(ctx.nodes)));
+    }
+
+    // Picks the cheapest of storing the tree in ctx.nodes (whose code is in
+    // ctx.code), reusing the last stored table and the dictionary. When reusing,
+    // writes the reference and returns the table.
+    static const HuffmanCode *reuseTable(CompressionContext &ctx, int escape, vector<uint8_t> &out) {
+        if (!ctx.reuseTables && !ctx.dictionary) {
+            return nullptr;
+        }
+        double best = ownTableBits(ctx, escape);
+        const HuffmanCode *table = nullptr;
+        uint32_t reference = 0;
+        if (ctx.reuseTables && ctx.tableBlock < ctx.block) {
+            const double cost = blockBits(ctx, ctx.tableCode, escape, 32);
+            if (cost <= best) {
+                best = cost;
+                table = &ctx.tableCode;
+                reference = ctx.tableBlock;
+            }
+        }
+        if (ctx.dictionary) {
+            const double cost = blockBits(ctx, ctx.dictionary->code, escape, 64);
+            if (cost <= best) {
+                table = &ctx.dictionary->code;
+                reference = dictionaryTable;
+            }
+        }
+        if (table) {
+            writeValue(out, reference);
+            if (reference == dictionaryTable) {
+                writeValue(out, ctx.dictionary->id);
+            }
+        }
+        return table;
+    }
+
+    // Replaces the codes that a reused table has no codeword for by the escape
+    // code, inserting their values among the outliers in code order
+    template <typename CodeT>
+    static void escapeMissingCodes(CompressionContext &ctx, vector<CodeT> &codes, const HuffmanCode &code) {
+        const int escape = escapeCode<CodeT>();
+        vector<int> &outliers = ctx.reuseOutliers;
+        outliers.clear();
+        const int *outlier = ctx.outliers.data();
+        for (CodeT &value : codes) {
+            if (value == escape) {
+                const int escaped = *outlier++;
+                outliers.push_back(escaped);
+                if (escaped == exactMarker) {
+                    outliers.insert(outliers.end(), outlier, outlier + 2);
+                    outlier += 2;
+                }
+            } else if (codeLength(code, value) == 0) {
+                outliers.push_back(value);
+                value = escape;
+            }
+        }
+        ctx.outliers.swap(outliers);
+    }
+
+    // Writes the tree (or a table reference) and the encoded codes. bufferSize is
+    // 0 when the block reuses a table.
+    template <typename CodeT>
+    static void encodeCodes(CompressionContext &ctx, vector<CodeT> &codes, vector<uint8_t> &out,
+                            unsigned &bufferSize, unsigned long long &encodedSize) {
+        const int escape = escapeCode<CodeT>();
+        Node *tree = buildBlockTable(ctx, escape);
+        const HuffmanCode *code = reuseTable(ctx, escape, out);
+        if (code) {
+            escapeMissingCodes(ctx, codes, *code);
+        }
+        bufferSize = 0;
+        if (!code) {
+            BitWriter treeWriter(out);
+            serializeTree(tree, treeWriter);
+            bufferSize = treeWriter.flush(); // Number of bits needed to store the tree
+            code = &ctx.code;
+            if (ctx.reuseTables) {
+                ctx.tableCode = ctx.code;
+                ctx.tableBlock = ctx.block;
+            }
+        }
+
+        BitWriter dataWriter(out);
+        encode(codes.data(), codes.size(), ctx.outliers.data(), *code, dataWriter);
+        encodedSize = dataWriter.flush();
+    }
+
+    // Writes the number of outliers and a zstd frame of the raw codes and outliers
+    template <typename CodeT>
+    static void zstdEncodeCodes(CompressionContext &ctx, const vector<CodeT> &codes, vector<uint8_t> &out) {
+        writeValue(out, (uint32_t)ctx.outliers.size());
+        vector<uint8_t> &buffer = ctx.entropyBuffer;
+        const uint8_t *codeBytes = reinterpret_cast<const uint8_t *>(codes.data());
+        const uint8_t *outlierBytes = reinterpret_cast<const uint8_t *>(ctx.outliers.data());
+        buffer.assign(codeBytes, codeBytes + codes.size() * sizeof(CodeT));
+        buffer.insert(buffer.end(), outlierBytes, outlierBytes + ctx.outliers.size() * sizeof(int));
+        zstdCompress(ctx.zstd, buffer.data(), buffer.size(), ctx.zstdLevel, out);
+    }
+
+    // Quantizes a block into 1- or 2-byte codes (size n-2) and returns the code width
+    template <typename T>
+    static uint8_t quantizeBlock(CompressionContext &ctx, const T *data, size_t n,
+                                 const Quantizer<T> &quantizer, ExtrapolationMethod extrapolationMethod,
+                                 ofstream *errorsLog, ofstream *levelsLog) {
+        uint8_t codeWidth = 2;
+        if (n > 2) {
+            withExtrapolationMethod(extrapolationMethod, [&](auto method) {
+                constexpr ExtrapolationMethod m = decltype(method)::value;
+                codeWidth = probeCodeWidth<m>(ctx, data, n, quantizer);
+                if (codeWidth == 1) {
+                    ctx.codes8.resize(n - 2);
+                    quantize<m>(data, n, quantizer, ctx.codes8.data(), ctx.outliers, ctx.histogram,
+                                errorsLog, levelsLog);
+                } else {
+                    ctx.codes16.resize(n - 2);
+                    quantize<m>(data, n, quantizer, ctx.codes16.data(), ctx.outliers, ctx.histogram,
+                                errorsLog, levelsLog);
+                }
+            });
+        }
+        return codeWidth;
+    }
+
+    // Size in bytes of the block that compressBlock would write with its own
+    // table for the codes left in ctx by quantizeBlock, computed from the code
+    // lengths alone. Reusing a table only happens when it is no larger.
+    static size_t quantizedBlockSize(CompressionContext &ctx, size_t n, size_t valueSize, uint8_t codeWidth) {
+        size_t size = sizeof(uint8_t) + min<size_t>(n, 2) * valueSize;
+        if (n <= 2) {
+            return size;
+        }
+
+        const int escape = codeWidth == 1 ? escapeCode<int8_t>() : escapeCode<int16_t>();
+        buildBlockTable(ctx, escape);
+        return size + sizeof(unsigned) + sizeof(unsigned long long) + (size_t)(ownTableBits(ctx, escape) / 8);
+    }
+
+    // Appends one independently decodable block
+    template <typename T>
+    static void compressBlock(CompressionContext &ctx, const T *data, size_t n,
+                              const Quantizer<T> &quantizer, ExtrapolationMethod extrapolationMethod,
+                              ofstream *errorsLog, ofstream *levelsLog, vector<uint8_t> &out) {
+        const uint8_t codeWidth = quantizeBlock(ctx, data, n, quantizer, extrapolationMethod,
+                                                errorsLog, levelsLog);
+
+        // 1 byte to store the code width, then the first two data points
+        writeValue(out, codeWidth);
+        for (size_t i = 0; i < min<size_t>(n, 2); ++i) {
+            writeValue(out, data[i]);
+        }
+
+        // Two data points leave nothing to encode
+        if (n <= 2) {
+            return;
+        }
+
+        const EntropyCoder coder = ctx.header.coder;
+        if (coder == zstdCoder) {
+            if (codeWidth == 1) {
+                zstdEncodeCodes(ctx, ctx.codes8, out);
+            } else {
+                zstdEncodeCodes(ctx, ctx.codes16, out);
+            }
+            return;
+        }
+
+        // With huffmanZstdCoder, the Huffman layout is built aside and compressed
+        vector<uint8_t> &target = coder == huffmanZstdCoder ? ctx.entropyBuffer : out;
+        if (coder == huffmanZstdCoder) {
+            target.clear();
+        }
+
+        // 4 + 8 bytes to store bufferSize and encodedSize, patched in once the
+        // tree and data have been written
+        const size_t sizesPos = target.size();
+        writeValue(target, 0U);
+        writeValue(target, 0ULL);
+
+        unsigned bufferSize;
+        unsigned long long encodedSize;
+        if (codeWidth == 1) {
+            encodeCodes(ctx, ctx.codes8, target, bufferSize, encodedSize);
+        } else {
+            encodeCodes(ctx, ctx.codes16, target, bufferSize, encodedSize);
+        }
+
+        patchValue(target, sizesPos, bufferSize);
+        patchValue(target, sizesPos + sizeof(bufferSize), encodedSize);
+        if (coder == huffmanZstdCoder) {
+            zstdCompress(ctx.zstd, target.data(), target.size(), ctx.zstdLevel, out);
+        }
+    }
+
+    // Appends a block of `levels` residual layers, see the progressive layout above
+    template <typename T>
+    static void compressProgressiveBlock(CompressionContext &ctx, const T *data, size_t n,
+                                         const Quantizer<T> &quantizer, int levels,
+                                         vector<uint8_t> &out) {
+        writeValue(out, (uint8_t)levels);
+        writeValue(out, data[0]);
+        const size_t sizesPos = out.size();
+        out.resize(out.size() + levels * sizeof(uint32_t));
+
+        vector<double> &reconstructed = ctx.reconstructed;
+        reconstructed.resize(n);
+        reconstructed[0] = data[0];
+        const size_t coarsestStride = (size_t)1 << (levels - 1);
+        for (int level = 0; level < levels; ++level) {
+            const size_t layerStart = out.size();
+            if (quantizeLevel(ctx, data, n, coarsestStride >> level, level == 0, quantizer,
+                              reconstructed.data()) > 0) {
+                const size_t layerSizesPos = out.size();
+                writeValue(out, 0U);
+                writeValue(out, 0ULL);
+                unsigned bufferSize;
+                unsigned long long encodedSize;
+                encodeCodes(ctx, ctx.codes16, out, bufferSize, encodedSize);
+                patchValue(out, layerSizesPos, bufferSize);
+                patchValue(out, layerSizesPos + sizeof(bufferSize), encodedSize);
+            }
+            patchValue(out, sizesPos + level * sizeof(uint32_t), (uint32_t)(out.size() - layerStart));
+        }
+    }
+
+    // Appends a block in point-wise relative mode: signs and zeros are stored
+    // separately and the log2 magnitudes are compressed with an absolute bound
+    template <typename T>
+    static void compressLogBlock(CompressionContext &ctx, const T *data, size_t n,
+                                 const Quantizer<double> &quantizer,
+                                 ExtrapolationMethod extrapolationMethod, ofstream *errorsLog,
+                                 ofstream *levelsLog, vector<uint8_t> &out) {
+        vector<double> &logMagnitudes = ctx.logMagnitudes;
+        logMagnitudes.resize(n);
+        bool hasNegatives = false;
+        double minLog = numeric_limits<double>::infinity();
+        for (size_t i = 0; i < n; ++i) {
+            hasNegatives |= data[i] < 0;
+            logMagnitudes[i] = log2(abs((double)data[i]));
+            if (data[i] != 0) {
+                minLog = min(minLog, logMagnitudes[i]);
+            }
+        }
+        if (minLog == numeric_limits<double>::infinity()) {
+            minLog = 0;
+        }
+
+        // Zeros sit 2 below the smallest magnitude. The log bound is at most 0.5,
+        // so a threshold halfway in between separates them after reconstruction.
+        const double zeroLog = minLog - 1;
+        for (size_t i = 0; i < n; ++i) {
+            if (data[i] == 0) {
+                logMagnitudes[i] = minLog - 2;
+            }
+        }
+
+        writeValue(out, (uint8_t)hasNegatives);
+        if (hasNegatives) {
+            BitWriter signWriter(out);
+            for (size_t i = 0; i < n; ++i) {
+                signWriter.write(data[i] < 0, 1);
+            }
+            signWriter.flush();
+        }
+        writeValue(out, zeroLog);
+
+        compressBlock(ctx, logMagnitudes.data(), n, quantizer, extrapolationMethod, errorsLog,
+                      levelsLog, out);
+    }
+
+    // Appends a block of exactly `budget` bytes, using the smallest error bound
+    // (within a few percent) whose coded block fits. `guess` seeds the search
+    // and is updated with the bound used, so neighbouring blocks start close.
+    template <typename T>
+    static void compressFixedRateBlock(CompressionContext &ctx, const T *data, size_t n,
+                                       size_t budget, ExtrapolationMethod extrapolationMethod,
+                                       double &guess, ofstream *errorsLog, ofstream *levelsLog,
+                                       vector<uint8_t> &out) {
+        auto fits = [&](double maxError) {
+            const uint8_t codeWidth = quantizeBlock(ctx, data, n, Quantizer<T>(maxError), extrapolationMethod,
+                                                    nullptr, nullptr);
+            return sizeof(double) + quantizedBlockSize(ctx, n, sizeof(T), codeWidth) <= budget;
+        };
+
+        double high = guess;
+        while (!fits(high)) {
+            // Past this every residual lands in bucket 0, so the block cannot shrink further
+            if (high > numeric_limits<float>::max()) {
+                throw runtime_error("Bit budget is too small for the block.");
+            }
+            high *= 4;
+        }
+        double low = high / 4;
+        for (int i = 0; i < fixedRateSearchSteps && fits(low); ++i) {
+            high = low;
+            low /= 4;
+        }
+        for (int i = 0; i < fixedRateRefineSteps; ++i) {
+            const double mid = sqrt(low * high);
+            if (fits(mid)) {
+                high = mid;
+            } else {
+                low = mid;
+            }
+        }
+        guess = high;
+
+        const size_t blockStart = out.size();
+        writeValue(out, high);
+        compressBlock(ctx, data, n, Quantizer<T>(high), extrapolationMethod, errorsLog, levelsLog, out);
+        if (out.size() - blockStart > budget) {
+            throw runtime_error("Fixed-rate block exceeds its bit budget.");
+        }
+        out.resize(blockStart + budget, 0);
+    }
+
+    // Mean squared error that reaches the target PSNR (dB) on the data, 0 for
+    // constant data
+    template <typename T>
+    static double psnrTargetMse(const T *data, size_t n, double targetPsnr) {
+        T minValue = numeric_limits<T>::max();
+        T maxValue = numeric_limits<T>::lowest();
+        for (size_t i = 0; i < n; ++i) {
+            minValue = min(minValue, data[i]);
+            maxValue = max(maxValue, data[i]);
+        }
+        const double range = n > 0 ? (double)maxValue - (double)minValue : 0;
+        return range * range / pow(10, targetPsnr / 10);
+    }
+
+    template <typename T>
+    double maxErrorForPsnr(CompressionContext &ctx, const T *data, size_t n, double targetPsnr,
+                           ExtrapolationMethod extrapolationMethod) {
+        const double targetMse = psnrTargetMse(data, n, targetPsnr);
+        if (targetMse == 0) {
+            // Constant data is reconstructed exactly by every predictor
+            return 1;
+        }
+
+        const size_t sampleSize = min(n, psnrSampleSize);
+        const size_t sampleBlocks = min(psnrSampleBlocks, n / sampleSize);
+
+        auto meanSquaredError = [&](double maxError) {
+            const Quantizer<T> quantizer(maxError);
+            double squaredError = 0;
+            withExtrapolationMethod(extrapolationMethod, [&](auto method) {
+                constexpr ExtrapolationMethod m = decltype(method)::value;
+                ctx.codes16.resize(sampleSize);
+                for (size_t k = 0; k < sampleBlocks; ++k) {
+                    const size_t start = sampleBlocks > 1 ? (n - sampleSize) / (sampleBlocks - 1) * k : 0;
+                    quantize<m>(data + start, sampleSize, quantizer, ctx.codes16.data(), ctx.outliers,
+                                ctx.histogram, nullptr, nullptr, &squaredError);
+                }
+            });
+            return squaredError / (sampleSize * sampleBlocks);
+        };
+
+        // Uniform quantization with step 2e gives an MSE of about e^2 / 3. Bracket
+        // the answer around that guess, then bisect in the log domain.
+        const double guess = sqrt(3 * targetMse);
+        double low = guess / 4, high = guess * 4;
+        for (int i = 0; i < psnrSearchSteps && meanSquaredError(low) > targetMse; ++i) {
+            high = low;
+            low /= 4;
+        }
+        for (int i = 0; i < psnrSearchSteps && meanSquaredError(high) <= targetMse; ++i) {
+            low = high;
+            high *= 4;
+        }
+        for (int i = 0; i < psnrSearchSteps; ++i) {
+            const double mid = sqrt(low * high);
+            if (meanSquaredError(mid) <= targetMse) {
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+        return low;
+    }
+
+    // Mean squared error of the whole data quantized block by block with the
+    // given bound, as compress would
+    template <typename T>
+    static double meanSquaredError(CompressionContext &ctx, const T *data, size_t n, double maxError,
+                                   const CompressionParams &params) {
+        const Quantizer<T> quantizer(maxError);
+        double squaredError = 0;
+        for (size_t i = 0; i < n; i += params.blockSize) {
+            const size_t count = min<size_t>(params.blockSize, n - i);
+            if (params.levels > 0) {
+                vector<double> &reconstructed = ctx.reconstructed;
+                reconstructed.resize(count);
+                reconstructed[0] = data[i];
+                const size_t coarsestStride = (size_t)1 << (params.levels - 1);
+                for (int level = 0; level < params.levels; ++level) {
+                    quantizeLevel(ctx, data + i, count, coarsestStride >> level, level == 0, quantizer,
+                                  reconstructed.data());
+                }
+                for (size_t j = 0; j < count; ++j) {
+                    const double err = reconstructed[j] - (double)data[i + j];
+                    squaredError += err * err;
+                }
+            } else if (count > 2) {
+                withExtrapolationMethod(params.extrapolationMethod, [&](auto method) {
+                    constexpr ExtrapolationMethod m = decltype(method)::value;
+                    ctx.codes16.resize(count - 2);
+                    quantize<m>(data + i, count, quantizer, ctx.codes16.data(), ctx.outliers, ctx.histogram,
+                                nullptr, nullptr, &squaredError);
+                });
+            }
+        }
+        return n > 0 ? squaredError / n : 0;
+    }
+
+    // Bound for the psnr error mode. maxErrorForPsnr only quantizes a sample of
+    // the data, so the bound is lowered until the whole data reaches the target.
+    template <typename T>
+    static double psnrErrorBound(CompressionContext &ctx, const T *data, size_t n,
+                                 const CompressionParams &params) {
+        double maxError = maxErrorForPsnr(ctx, data, n, params.error, params.extrapolationMethod);
+        const double targetMse = psnrTargetMse(data, n, params.error);
+        for (int i = 0; i < psnrCheckSteps; ++i) {
+            const double mse = meanSquaredError(ctx, data, n, maxError, params);
+            if (mse <= targetMse) {
+                return maxError;
+            }
+            // The error grows about linearly with the bound; aim slightly below the target
+            maxError *= min(0.99 * sqrt(targetMse / mse), 0.99);
+        }
+        throw runtime_error("Target PSNR cannot be reached.");
+    }
+
+    // Error bound stored in the header for the given error mode: the absolute
+    // bound, the bound on log2 magnitudes in point-wise relative mode, or the
+    // bits per sample in fixed-rate mode
+    template <typename T>
+    static double errorBound(CompressionContext &ctx, const T *data, size_t n,
+                             const CompressionParams &params) {
+        using Work = typename Quantizer<T>::Work;
+        double maxError;
+        // Calculate absolute error
+        if (params.errorMode == absolute) {
+            maxError = (Work)params.error;
+        } else if (params.errorMode == pointwise) {
+            if (is_integral<T>::value) {
+                throw runtime_error("Point-wise relative error requires floating-point data.");
+            }
+            // Bound on the log2 magnitudes: 2^maxError - 1 <= error, with a margin
+            // for rounding the reconstructed magnitudes back to T
+            maxError = min(log2(1 + params.error) - numeric_limits<T>::epsilon(), 0.5);
+            if (maxError <= 0) {
+                throw runtime_error("Point-wise relative error is below the precision of the data type.");
+            }
+        } else if (params.errorMode == psnr) {
+            maxError = psnrErrorBound(ctx, data, n, params);
+        } else if (params.errorMode == fixedRate) {
+            // Stored in place of the error bound, each block records its own
+            maxError = params.error;
+        } else {
+            T minValue = numeric_limits<T>::max();
+            T maxValue = numeric_limits<T>::lowest();
+
+            for (size_t i = 0; i < n; ++i) {
+                if (data[i] < minValue)
+                    minValue = data[i];
+                if (data[i] > maxValue)
+                    maxValue = data[i];
+            }
+
+            Work range = (Work)maxValue - (Work)minValue;
+            maxError = (Work)(range * (Work)params.error);
+        }
+        return maxError;
+    }
+
+    template <typename T>
+    size_t compress(CompressionContext &ctx, const T *data, size_t n,
+                    const CompressionParams &params, vector<uint8_t> &out) {
+        if (params.blockSize == 0) {
+            throw runtime_error("Block size must be positive.");
+        }
+        if (params.dims.size() > maxDims) {
+            throw runtime_error("Too many dimensions.");
+        }
+
+        ofstream extrapErrorsFile, quantizationLevelsFile;
+        const bool debugMode = !params.debugPrefix.empty();
+        if (debugMode) {
+            extrapErrorsFile.open(params.debugPrefix + "-extrap-errors.txt");
+            quantizationLevelsFile.open(params.debugPrefix + "-quantization-levels.txt");
+        }
+
+        const bool pointwiseMode = params.errorMode == pointwise;
+        const bool fixedRateMode = params.errorMode == fixedRate;
+        const bool progressiveMode = params.levels > 0;
+        if (progressiveMode) {
+            if (pointwiseMode || fixedRateMode) {
+                throw runtime_error("Progressive encoding requires an absolute, relative or PSNR error bound.");
+            }
+            if (params.levels > maxLevels || params.blockSize % (1U << (params.levels - 1)) != 0) {
+                throw runtime_error("Block size must be a multiple of 2^(levels - 1).");
+            }
+        }
+        if (fixedRateMode) {
+            checkFixedRate(params.error);
+        }
+        const bool huffmanMode = params.coder == huffmanCoder;
+        if (!huffmanMode) {
+            if (params.coder != zstdCoder && params.coder != huffmanZstdCoder) {
+                throw runtime_error("Unknown entropy coder.");
+            }
+            if (progressiveMode || fixedRateMode) {
+                throw runtime_error("The zstd coders do not support progressive or fixed-rate encoding.");
+            }
+            if (!zstdSupported()) {
+                throw runtime_error("libsdrhuff was built without zstd.");
+            }
+        }
+
+        const double maxError = errorBound(ctx, data, n, params);
+        ContainerHeader &header = ctx.header;
+        header.flags = pointwiseMode ? pointwiseRelativeFlag : fixedRateMode ? fixedRateFlag : 0;
+        if (progressiveMode) {
+            header.flags |= progressiveFlag;
+        }
+        header.dtype = dataTypeOf<T>();
+        header.predictor = params.extrapolationMethod;
+        header.coder = params.coder;
+        if (params.dims.empty()) {
+            header.dims.assign(1, n);
+        } else {
+            header.dims.assign(params.dims.begin(), params.dims.end());
+        }
+        if (header.count() != n) {
+            throw runtime_error("Dimensions do not match the number of samples.");
+        }
+        header.maxError = maxError;
+        header.blockSize = params.blockSize;
+        header.blocks.resize((n + params.blockSize - 1) / params.blockSize);
+
+        const Quantizer<T> quantizer(header.maxError);
+        const Quantizer<double> logQuantizer(header.maxError);
+
+        // Progressive layers always store their own tables, and blocks coded with
+        // zstd have no table to share
+        ctx.reuseTables = params.reuseTables && !progressiveMode && huffmanMode;
+        ctx.dictionary = progressiveMode || !huffmanMode ? nullptr : params.dictionary;
+        ctx.zstdLevel = params.zstdLevel;
+        ctx.tableBlock = numeric_limits<uint32_t>::max();
+        if (ctx.reuseTables || ctx.dictionary) {
+            header.flags |= tableReuseFlag;
+        }
+
+        // The header is written last, once the block table is known
+        out.clear();
+        out.resize(header.size());
+        const size_t payloadStart = out.size();
+        // Initial fixed-rate guess: the range split into 2^bitsPerSample levels
+        double fixedRateGuess = 1;
+        if (fixedRateMode && n > 0) {
+            const auto range = minmax_element(data, data + n);
+            fixedRateGuess = max(((double)*range.second - *range.first) / exp2(params.error), 1E-30);
+        }
+
+        for (size_t i = 0; i < header.blocks.size(); ++i) {
+            const size_t blockStart = out.size();
+            ctx.block = i;
+            ofstream *errorsLog = debugMode ? &extrapErrorsFile : nullptr;
+            ofstream *levelsLog = debugMode ? &quantizationLevelsFile : nullptr;
+            if (progressiveMode) {
+                compressProgressiveBlock(ctx, data + i * params.blockSize, header.blockCount(i),
+                                         quantizer, params.levels, out);
+            } else if (fixedRateMode) {
+                compressFixedRateBlock(ctx, data + i * params.blockSize, header.blockCount(i),
+                                       fixedRateBlockBytes(header.blockCount(i), params.error),
+                                       params.extrapolationMethod, fixedRateGuess, errorsLog,
+                                       levelsLog, out);
+            } else if (pointwiseMode) {
+                compressLogBlock(ctx, data + i * params.blockSize, header.blockCount(i), logQuantizer,
+                                 params.extrapolationMethod, errorsLog, levelsLog, out);
+            } else {
+                compressBlock(ctx, data + i * params.blockSize, header.blockCount(i), quantizer,
+                              params.extrapolationMethod, errorsLog, levelsLog, out);
+            }
+
+            BlockInfo &block = header.blocks[i];
+            block.offset = blockStart - payloadStart;
+            block.size = out.size() - blockStart;
+            block.checksum = xxhash32(out.data() + blockStart, block.size);
+        }
+
+        writeContainerHeader(header, out.data());
+        return out.size();
+    }
+
+    template <typename T>
+    size_t compress(CompressionContext &ctx, const T *data, size_t n,
+                    const CompressionParams &params, uint8_t *dst, size_t dstCapacity) {
+        compress(ctx, data, n, params, ctx.output);
+        if (ctx.output.size() > dstCapacity) {
+            throw runtime_error("Destination buffer is too small.");
+        }
+        memcpy(dst, ctx.output.data(), ctx.output.size());
+        return ctx.output.size();
+    }
+
+    template <typename T>
+    void trainDictionary(CompressionContext &ctx, const T *data, size_t n,
+                         const CompressionParams &params, HuffmanDictionary &dictionary) {
+        if (params.errorMode == pointwise || params.errorMode == fixedRate || params.levels > 0) {
+            throw runtime_error("Dictionaries require an absolute, relative or PSNR error bound.");
+        }
+        const Quantizer<T> quantizer(errorBound(ctx, data, n, params));
+
+        Histogram &histogram = dictionary.histogram;
+        for (size_t i = 0; i < n; i += params.blockSize) {
+            quantizeBlock(ctx, data + i, min<size_t>(params.blockSize, n - i), quantizer,
+                          params.extrapolationMethod, nullptr, nullptr);
+            for (size_t j = 0; j < ctx.histogram.counts.size(); ++j) {
+                if (ctx.histogram.counts[j] > 0) {
+                    histogram.add(ctx.histogram.minValue + (int)j, ctx.histogram.counts[j]);
+                }
+            }
+        }
+
+        // Give every code between the smallest and largest one seen a codeword,
+        // so that blocks with slightly different statistics can still use the
+        // table. The escapes lie far from the other codes and are left out of
+        // that range, or thousands of unused codewords would lengthen the rest.
+        const int escape8 = escapeCode<int8_t>();
+        const int escape16 = escapeCode<int16_t>();
+        int smallest = numeric_limits<int>::max();
+        int largest = numeric_limits<int>::min();
+        for (size_t j = 0; j < histogram.counts.size(); ++j) {
+            const int value = histogram.minValue + (int)j;
+            if (histogram.counts[j] > 0 && value != escape8 && value != escape16) {
+                smallest = min(smallest, value);
+                largest = max(largest, value);
+            }
+        }
+        if (smallest > largest) {
+            return;
+        }
+        for (int value = smallest; value <= largest; ++value) {
+            if (histogram.count(value) == 0) {
+                histogram.add(value);
+            }
+        }
+        // Blocks of 1-byte codes escape the codes the table lacks, so the table
+        // always has that escape. The 2-byte one only when training needed it.
+        if (histogram.count(escape8) == 0) {
+            histogram.add(escape8);
+        }
+
+        size_t first = 0;
+        size_t last = histogram.counts.size();
+        while (histogram.counts[first] == 0) {
+            first++;
+        }
+        while (histogram.counts[last - 1] == 0) {
+            last--;
+        }
+
+        // Only the code lengths of the Huffman tree are kept, the codewords are
+        // reassigned canonically so that the lengths alone can be stored. Node
+        // frequencies are 32-bit and buildDictionary rejects codewords longer
+        // than maxDictionaryCodeLength, so the counts of a large training set
+        // are halved until their total fits and the tree is shallow enough.
+        Histogram counts = histogram;
+        unsigned long long total = 0;
+        for (const unsigned &count : counts.counts) {
+            total += count;
+        }
+        vector<Node *> heap;
+        while (true) {
+            if (total <= numeric_limits<unsigned>::max()) {
+                Node *tree = generateHuffmanTree(counts, dictionary.nodes, heap);
+                getHuffmanCode(tree, counts.minValue + (int)first, counts.minValue + (int)last - 1,
+                               dictionary.code);
+                const vector<uint8_t> &lengths = dictionary.code.lengths;
+                if (*max_element(lengths.begin(), lengths.end()) <= maxDictionaryCodeLength) {
+                    break;
+                }
+            }
+            total = 0;
+            for (unsigned &count : counts.counts) {
+                count = (count + 1) / 2;
+                total += count;
+            }
+        }
+        buildDictionary(dictionary);
+    }
+
+    template <typename T>
+    CompressionEstimate estimate(CompressionContext &ctx, const T *data, size_t n,
+                                 const CompressionParams &params) {
+        if (params.errorMode == pointwise || params.errorMode == fixedRate || params.levels > 0) {
+            throw runtime_error("Estimates require an absolute, relative or PSNR error bound.");
+        }
+        if (params.blockSize == 0) {
+            throw runtime_error("Block size must be positive.");
+        }
+        const Quantizer<T> quantizer(errorBound(ctx, data, n, params));
+        // Left over from an earlier compress, it would add escape leaves to the tables
+        ctx.reuseTables = false;
+
+        const size_t numBlocks = (n + params.blockSize - 1) / params.blockSize;
+        size_t size = containerHeaderSize(max<size_t>(params.dims.size(), 1), numBlocks);
+        double bits = 0;
+        size_t codes = 0;
+        for (size_t i = 0; i < n; i += params.blockSize) {
+            const size_t count = min<size_t>(params.blockSize, n - i);
+            const uint8_t codeWidth = quantizeBlock(ctx, data + i, count, quantizer, params.extrapolationMethod,
+                                                    nullptr, nullptr);
+            size += quantizedBlockSize(ctx, count, sizeof(T), codeWidth);
+            if (count > 2) {
+                bits += entropyBits(ctx.histogram);
+                codes += count - 2;
+            }
+        }
+
+        CompressionEstimate result;
+        result.entropy = codes > 0 ? bits / codes : 0;
+        result.size = size;
+        result.ratio = (double)n * sizeof(T) / size;
+        return result;
+    }
+
+    void readHeader(const uint8_t *src, size_t srcSize, ContainerHeader &header) {
+        readContainerHeader(src, srcSize, header);
+    }
+
+    bool validate(const uint8_t *src, size_t srcSize) {
+        try {
+            ContainerHeader header;
+            const size_t payloadStart = readContainerHeader(src, srcSize, header);
+            for (const BlockInfo &block : header.blocks) {
+                if (xxhash32(src + payloadStart + block.offset, block.size) != block.checksum) {
+                    return false;
+                }
+            }
+            return true;
+        } catch (const runtime_error &) {
+            return false;
+        }
+    }
+
+    size_t getDecompressedSize(const uint8_t *src, size_t srcSize) {
+        ContainerHeader header;
+        readContainerHeader(src, srcSize, header);
+        return header.count();
+    }
+
+    // Returns the tree stored by block `index` of the container in ctx.header,
+    // deserializing it into ctx.tableNodes unless it is already there
+    static Node *referencedTable(DecompressionContext &ctx, const uint8_t *payload, uint32_t index) {
+        if (ctx.table && index == ctx.tableBlock) {
+            return ctx.table;
+        }
+        const ContainerHeader &header = ctx.header;
+        if (index >= header.blocks.size()) {
+            throw runtime_error("Compressed buffer is corrupt.");
+        }
+        const BlockInfo &block = header.blocks[index];
+        const uint8_t *src = payload + block.offset;
+        if (xxhash32(src, block.size) != block.checksum) {
+            throw runtime_error("Block checksum mismatch.");
+        }
+
+        // Skip to the tree, past the prefixes of the block layouts above
+        const size_t n = header.blockCount(index);
+        size_t valueSize = dataTypeSize(header.dtype);
+        size_t pos = 0;
+        if (header.flags & fixedRateFlag) {
+            pos += sizeof(double);
+        }
+        if (header.flags & pointwiseRelativeFlag) {
+            if (readValue<uint8_t>(src, block.size, pos)) {
+                pos += (n + 7) / 8;
+            }
+            pos += sizeof(double);
+            valueSize = sizeof(double);
+        }
+        const uint8_t codeWidth = readValue<uint8_t>(src, block.size, pos);
+        pos += min<size_t>(n, 2) * valueSize;
+        const unsigned bufferSize = readValue<unsigned>(src, block.size, pos);
+        pos += sizeof(unsigned long long);
+        if (bufferSize == 0 || !bitsFit(bufferSize, block.size, pos)) {
+            throw runtime_error("Compressed buffer is corrupt.");
+        }
+
+        ctx.table = nullptr;
+        ctx.tableNodes.reset(2 * (bufferSize / 33) + 1);
+        BitReader treeReader(src + pos, bufferSize);
+        const int minValue = codeWidth == 1 ? numeric_limits<int8_t>::min() : numeric_limits<int16_t>::min();
+        const int maxValue = codeWidth == 1 ? numeric_limits<int8_t>::max() : numeric_limits<int16_t>::max();
+        ctx.table = deserializeTree(treeReader, ctx.tableNodes, minValue, maxValue);
+        ctx.tableBlock = index;
+        return ctx.table;
+    }
+
+    // The reconstruction reads the outliers without bounds checks, so every
+    // escaped code must have its words (three for an exact sample) and no
+    // words may be left over
+    template <typename CodeT>
+    static void checkOutliers(const vector<CodeT> &codes, const vector<int> &outliers) {
+        const int escape = escapeCode<CodeT>();
+        size_t used = 0;
+        for (const CodeT &code : codes) {
+            if (code != escape) {
+                continue;
+            }
+            if (used >= outliers.size()) {
+                throw runtime_error("Compressed buffer is corrupt.");
+            }
+            used += outliers[used] == exactMarker ? 3 : 1;
+        }
+        if (used != outliers.size()) {
+            throw runtime_error("Compressed buffer is corrupt.");
+        }
+    }
+
+    // Reads a serialized tree (or a table reference, resolved against payload)
+    // and decodes count codes, starting at src[pos]
+    template <typename CodeT>
+    static void decodeCodes(DecompressionContext &ctx, const uint8_t *src, size_t srcSize, size_t pos,
+                            size_t count, const uint8_t *payload, vector<CodeT> &codes) {
+        const unsigned bufferSize = readValue<unsigned>(src, srcSize, pos);
+        const unsigned long long encodedSize = readValue<unsigned long long>(src, srcSize, pos);
+
+        Node *deserializedTree;
+        if (bufferSize == 0) {
+            if (!payload || !(ctx.header.flags & tableReuseFlag)) {
+                throw runtime_error("Compressed buffer is corrupt.");
+            }
+            const uint32_t table = readValue<uint32_t>(src, srcSize, pos);
+            if (table == dictionaryTable) {
+                const uint32_t id = readValue<uint32_t>(src, srcSize, pos);
+                if (!ctx.dictionary || ctx.dictionary->id != id) {
+                    throw runtime_error("Compressed data references a dictionary that was not provided.");
+                }
+                deserializedTree = ctx.dictionary->tree;
+            } else {
+                deserializedTree = referencedTable(ctx, payload, table);
+            }
+        } else {
+            if (!bitsFit(bufferSize, srcSize, pos)) {
+                throw runtime_error("Compressed buffer is truncated.");
+            }
+            // Every leaf takes 33 bits, and a tree with k leaves has 2k - 1 nodes
+            ctx.nodes.reset(2 * (bufferSize / 33) + 1);
+            BitReader treeReader(src + pos, bufferSize);
+            deserializedTree = deserializeTree(treeReader, ctx.nodes, numeric_limits<CodeT>::min(),
+                                               numeric_limits<CodeT>::max());
+            pos += (bufferSize + 7ULL) / 8;
+        }
+        if (!bitsFit(encodedSize, srcSize, pos)) {
+            throw runtime_error("Compressed buffer is truncated.");
+        }
+
+        BitReader dataReader(src + pos, encodedSize);
+        codes.resize(count);
+        decode(dataReader, deserializedTree, codes.data(), count, ctx.outliers);
+        // A reused table may hold values wider than CodeT
+        checkOutliers(codes, ctx.outliers);
+    }
+
+    // Decodes count codes of a block coded with the zstd coders, starting at src[pos]
+    template <typename CodeT>
+    static void zstdDecodeCodes(DecompressionContext &ctx, const uint8_t *src, size_t srcSize, size_t pos,
+                                size_t count, const uint8_t *payload, vector<CodeT> &codes) {
+        vector<uint8_t> &buffer = ctx.entropyBuffer;
+        if (ctx.header.coder == huffmanZstdCoder) {
+            zstdDecompress(ctx.zstd, src + pos, srcSize - pos, blockBound(count + 2), buffer);
+            decodeCodes(ctx, buffer.data(), buffer.size(), 0, count, payload, codes);
+            return;
+        }
+
+        const uint32_t numOutliers = readValue<uint32_t>(src, srcSize, pos);
+        // Each code has at most one escaped value, three words for an exact sample
+        if (numOutliers > 3 * count) {
+            throw runtime_error("Compressed buffer is corrupt.");
+        }
+        const size_t codesSize = count * sizeof(CodeT);
+        const size_t size = codesSize + numOutliers * sizeof(int);
+        zstdDecompress(ctx.zstd, src + pos, srcSize - pos, size, buffer);
+        if (buffer.size() != size) {
+            throw runtime_error("Compressed buffer is corrupt.");
+        }
+        codes.resize(count);
+        memcpy(codes.data(), buffer.data(), codesSize);
+        ctx.outliers.resize(numOutliers);
+        memcpy(ctx.outliers.data(), buffer.data() + codesSize, numOutliers * sizeof(int));
+        checkOutliers(codes, ctx.outliers);
+    }
+
+    // Decodes the first `levels` levels (1 to numLevels) of a progressive block,
+    // writing every 2^(numLevels - levels)-th sample to dst. Every block of a
+    // container must store the same numLevels, or its samples would land at
+    // other positions than the caller sized dst for.
+    template <typename T>
+    static void decodeProgressiveBlock(DecompressionContext &ctx, const uint8_t *src, size_t srcSize,
+                                       size_t n, const Quantizer<T> &quantizer, int numLevels, int levels,
+                                       T *dst) {
+        size_t pos = 0;
+        if (readValue<uint8_t>(src, srcSize, pos) != numLevels) {
+            throw runtime_error("Compressed buffer is corrupt.");
+        }
+        dst[0] = readValue<T>(src, srcSize, pos);
+
+        size_t layerPos = pos + numLevels * sizeof(uint32_t);
+        const size_t coarsestStride = (size_t)1 << (numLevels - 1);
+        const int shift = numLevels - levels;
+        for (int level = 0; level < levels; ++level) {
+            const uint32_t layerSize = readValue<uint32_t>(src, srcSize, pos);
+            const size_t stride = coarsestStride >> level;
+            const size_t count = levelCount(n, stride, level == 0);
+            if (count > 0) {
+                decodeCodes(ctx, src, srcSize, layerPos, count, nullptr, ctx.codes16);
+                reconstructLevel(ctx.codes16.data(), ctx.outliers, n, stride, level == 0, shift,
+                                 quantizer, dst);
+            }
+            layerPos += layerSize;
+        }
+    }
+
+    // Decodes n samples coded by compressBlock, starting at src[pos]
+    template <typename T>
+    static void decodeBlock(DecompressionContext &ctx, const uint8_t *src, size_t srcSize, size_t pos,
+                            size_t n, const Quantizer<T> &quantizer,
+                            ExtrapolationMethod extrapolationMethod, const uint8_t *payload,
+                            T *dst) {
+        const uint8_t codeWidth = readValue<uint8_t>(src, srcSize, pos);
+        if (codeWidth != 1 && codeWidth != 2) {
+            throw runtime_error("Compressed buffer is corrupt.");
+        }
+        for (size_t j = 0; j < min<size_t>(n, 2); ++j) {
+            dst[j] = readValue<T>(src, srcSize, pos);
+        }
+        if (n <= 2) {
+            return;
+        }
+
+        withExtrapolationMethod(extrapolationMethod, [&](auto method) {
+            constexpr ExtrapolationMethod m = decltype(method)::value;
+            const bool huffmanMode = ctx.header.coder == huffmanCoder;
+            if (codeWidth == 1) {
+                if (huffmanMode) {
+                    decodeCodes(ctx, src, srcSize, pos, n - 2, payload, ctx.codes8);
+                } else {
+                    zstdDecodeCodes(ctx, src, srcSize, pos, n - 2, payload, ctx.codes8);
+                }
+                reconstruct<m>(ctx.codes8.data(), n - 2, ctx.outliers, quantizer, dst);
+            } else {
+                if (huffmanMode) {
+                    decodeCodes(ctx, src, srcSize, pos, n - 2, payload, ctx.codes16);
+                } else {
+                    zstdDecodeCodes(ctx, src, srcSize, pos, n - 2, payload, ctx.codes16);
+                }
+                reconstruct<m>(ctx.codes16.data(), n - 2, ctx.outliers, quantizer, dst);
+            }
+        });
+    }
+
+    // Number of levels stored in a progressive container, read from its first
+    // block. decodeProgressiveBlock rejects blocks that store another number.
+    static int storedLevels(const ContainerHeader &header, const uint8_t *payload) {
+        if (!(header.flags & progressiveFlag)) {
+            throw runtime_error("Not a progressive container.");
+        }
+        if (header.blocks.empty()) {
+            return 1;
+        }
+        size_t pos = 0;
+        const int numLevels = readValue<uint8_t>(payload + header.blocks[0].offset, header.blocks[0].size, pos);
+        if (numLevels == 0 || numLevels > maxLevels || header.blockSize % (1U << (numLevels - 1)) != 0) {
+            throw runtime_error("Compressed buffer is corrupt.");
+        }
+        return numLevels;
+    }
+
+    // Decodes block i of a parsed container into dst
+    template <typename T>
+    static void decompressBlockAt(DecompressionContext &ctx, const ContainerHeader &header,
+                                  const uint8_t *payload, size_t i, T *dst) {
+        const BlockInfo &block = header.blocks[i];
+        const uint8_t *src = payload + block.offset;
+        const size_t srcSize = block.size;
+        if (xxhash32(src, srcSize) != block.checksum) {
+            throw runtime_error("Block checksum mismatch.");
+        }
+
+        const size_t n = header.blockCount(i);
+        if (header.flags & progressiveFlag) {
+            const int numLevels = storedLevels(header, payload);
+            decodeProgressiveBlock(ctx, src, srcSize, n, Quantizer<T>(header.maxError), numLevels, numLevels,
+                                   dst);
+            return;
+        }
+        if (header.flags & fixedRateFlag) {
+            size_t pos = 0;
+            const double maxError = readValue<double>(src, srcSize, pos);
+            decodeBlock(ctx, src, srcSize, pos, n, Quantizer<T>(maxError), header.predictor, payload,
+                        dst);
+            return;
+        }
+        if (!(header.flags & pointwiseRelativeFlag)) {
+            decodeBlock(ctx, src, srcSize, 0, n, Quantizer<T>(header.maxError), header.predictor,
+                        payload, dst);
+            return;
+        }
+
+        size_t pos = 0;
+        const bool hasNegatives = readValue<uint8_t>(src, srcSize, pos);
+        const uint8_t *signs = src + pos;
+        if (hasNegatives) {
+            pos += (n + 7) / 8;
+        }
+        const double zeroLog = readValue<double>(src, srcSize, pos);
+
+        vector<double> &logMagnitudes = ctx.logMagnitudes;
+        logMagnitudes.resize(n);
+        decodeBlock(ctx, src, srcSize, pos, n, Quantizer<double>(header.maxError), header.predictor,
+                    payload, logMagnitudes.data());
+        for (size_t j = 0; j < n; ++j) {
+            const double magnitude = logMagnitudes[j] < zeroLog ? 0 : exp2(logMagnitudes[j]);
+            const bool negative = hasNegatives && ((signs[j >> 3] >> (j & 7)) & 1);
+            dst[j] = (T)(negative ? -magnitude : magnitude);
+        }
+    }
+
+    // Parses the header into ctx.header and drops any table cached from another container
+    static size_t openContainer(DecompressionContext &ctx, const uint8_t *src, size_t srcSize) {
+        ctx.table = nullptr;
+        return readContainerHeader(src, srcSize, ctx.header);
+    }
+
+    template <typename T>
+    static void checkDataType(const ContainerHeader &header) {
+        if (header.dtype != dataTypeOf<T>()) {
+            throw runtime_error("Element type does not match the compressed data.");
+        }
+    }
+
+    template <typename T>
+    size_t decompress(DecompressionContext &ctx, const uint8_t *src, size_t srcSize,
+                      T *dst, size_t dstCapacity) {
+        const ContainerHeader &header = ctx.header;
+        const size_t payloadStart = openContainer(ctx, src, srcSize);
+        checkDataType<T>(header);
+        const uint64_t n = header.count();
+        if (n > dstCapacity) {
+            throw runtime_error("Destination buffer is too small.");
+        }
+
+        for (size_t i = 0; i < header.blocks.size(); ++i) {
+            decompressBlockAt(ctx, header, src + payloadStart, i, dst + i * header.blockSize);
+        }
+        return n;
+    }
+
+    double ErrorStats::meanError() const {
+        return count ? sumError / count : 0;
+    }
+
+    double ErrorStats::rmse() const {
+        return count ? sqrt(sumSquaredError / count) : 0;
+    }
+
+    double ErrorStats::psnr() const {
+        if (sumSquaredError == 0) {
+            return numeric_limits<double>::infinity();
+        }
+        return 20 * log10(maxValue - minValue) - 10 * log10(sumSquaredError / count);
+    }
+
+    // Adds n samples to stats. A sample violates the bound when its error exceeds
+    // bound + relativeBound * |x|.
+    template <typename T>
+    static void accumulateErrors(const T *original, const T *reconstructed, size_t n, double bound,
+                                 double relativeBound, ErrorStats &stats) {
+        double maxError = stats.maxError;
+        double sumError = 0;
+        double sumSquaredError = 0;
+        double minValue = stats.minValue;
+        double maxValue = stats.maxValue;
+        size_t violations = 0;
+        for (size_t j = 0; j < n; ++j) {
+            const double x = original[j];
+            const double error = abs((double)reconstructed[j] - x);
+            maxError = max(maxError, error);
+            sumError += error;
+            sumSquaredError += error * error;
+            minValue = min(minValue, x);
+            maxValue = max(maxValue, x);
+            violations += error > bound + relativeBound * abs(x);
+        }
+        stats.count += n;
+        stats.maxError = maxError;
+        stats.sumError += sumError;
+        stats.sumSquaredError += sumSquaredError;
+        stats.minValue = minValue;
+        stats.maxValue = maxValue;
+        stats.violations += violations;
+    }
+
+    template <typename T>
+    size_t decompressAndVerify(DecompressionContext &ctx, const uint8_t *src, size_t srcSize,
+                               const T *original, T *dst, size_t dstCapacity, ErrorStats &stats) {
+        const ContainerHeader &header = ctx.header;
+        const size_t payloadStart = openContainer(ctx, src, srcSize);
+        checkDataType<T>(header);
+        const uint64_t n = header.count();
+        if (n > dstCapacity) {
+            throw runtime_error("Destination buffer is too small.");
+        }
+
+        double bound = header.maxError;
+        double relativeBound = 0;
+        if (header.flags & pointwiseRelativeFlag) {
+            // Undo the margin compress takes off the log bound
+            bound = 0;
+            relativeBound = exp2(header.maxError + numeric_limits<T>::epsilon()) - 1;
+        }
+        for (size_t i = 0; i < header.blocks.size(); ++i) {
+            const size_t offset = i * header.blockSize;
+            decompressBlockAt(ctx, header, src + payloadStart, i, dst + offset);
+            if (header.flags & fixedRateFlag) {
+                const BlockInfo &block = header.blocks[i];
+                size_t pos = 0;
+                bound = readValue<double>(src + payloadStart + block.offset, block.size, pos);
+            }
+            accumulateErrors(original + offset, dst + offset, header.blockCount(i), bound,
+                             relativeBound, stats);
+        }
+        return n;
+    }
+
+    template <typename T>
+    size_t decompressBlock(DecompressionContext &ctx, const uint8_t *src, size_t srcSize,
+                           size_t index, T *dst, size_t dstCapacity) {
+        const ContainerHeader &header = ctx.header;
+        const size_t payloadStart = openContainer(ctx, src, srcSize);
+        checkDataType<T>(header);
+        if (index >= header.blocks.size()) {
+            throw runtime_error("Block index out of range.");
+        }
+        const size_t n = header.blockCount(index);
+        if (n > dstCapacity) {
+            throw runtime_error("Destination buffer is too small.");
+        }
+
+        decompressBlockAt(ctx, header, src + payloadStart, index, dst);
+        return n;
+    }
+
+    size_t getPreviewSize(const uint8_t *src, size_t srcSize, int levels) {
+        ContainerHeader header;
+        const size_t payloadStart = readContainerHeader(src, srcSize, header);
+        const int numLevels = storedLevels(header, src + payloadStart);
+        const int shift = numLevels - max(1, min(levels, numLevels));
+        return (header.count() + ((size_t)1 << shift) - 1) >> shift;
+    }
+
+    template <typename T>
+    size_t decompressPreview(DecompressionContext &ctx, const uint8_t *src, size_t srcSize, int levels,
+                             T *dst, size_t dstCapacity) {
+        const ContainerHeader &header = ctx.header;
+        const size_t payloadStart = openContainer(ctx, src, srcSize);
+        checkDataType<T>(header);
+        const int numLevels = storedLevels(header, src + payloadStart);
+        levels = max(1, min(levels, numLevels));
+        const int shift = numLevels - levels;
+        const size_t previewSize = (header.count() + ((size_t)1 << shift) - 1) >> shift;
+        if (previewSize > dstCapacity) {
+            throw runtime_error("Destination buffer is too small.");
+        }
+
+        // The block size is a multiple of the coarsest stride, so every block
+        // starts on a preview sample
+        const Quantizer<T> quantizer(header.maxError);
+        for (size_t i = 0; i < header.blocks.size(); ++i) {
+            const BlockInfo &block = header.blocks[i];
+            const size_t n = header.blockCount(i);
+            const size_t offset = (i * header.blockSize) >> shift;
+            if (offset + ((n + ((size_t)1 << shift) - 1) >> shift) > previewSize) {
+                throw runtime_error("Compressed buffer is corrupt.");
+            }
+            decodeProgressiveBlock(ctx, src + payloadStart + block.offset, block.size, n, quantizer,
+                                   numLevels, levels, dst + offset);
+        }
+        return previewSize;
+    }
+
+#define SDRHUFF_INSTANTIATE(T)                                                                    \
+    template size_t compress<T>(CompressionContext &, const T *, size_t,                          \
+                                const CompressionParams &, vector<uint8_t> &);                    \
+    template size_t compress<T>(CompressionContext &, const T *, size_t,                          \
+                                const CompressionParams &, uint8_t *, size_t);                    \
+    template size_t decompress<T>(DecompressionContext &, const uint8_t *, size_t, T *, size_t);  \
+    template size_t decompressAndVerify<T>(DecompressionContext &, const uint8_t *, size_t,       \
+                                           const T *, T *, size_t, ErrorStats &);                \
+    template size_t decompressBlock<T>(DecompressionContext &, const uint8_t *, size_t, size_t,   \
+                                       T *, size_t);                                              \
+    template void trainDictionary<T>(CompressionContext &, const T *, size_t,                     \
+                                     const CompressionParams &, HuffmanDictionary &);             \
+    template CompressionEstimate estimate<T>(CompressionContext &, const T *, size_t,             \
+                                             const CompressionParams &);                          \
+    template double maxErrorForPsnr<T>(CompressionContext &, const T *, size_t, double,           \
+                                       ExtrapolationMethod);                                      \
+    template size_t decompressPreview<T>(DecompressionContext &, const uint8_t *, size_t, int,    \
+                                         T *, size_t);
+
+    SDRHUFF_INSTANTIATE(float)
+    SDRHUFF_INSTANTIATE(double)
+    SDRHUFF_INSTANTIATE(int16_t)
+    SDRHUFF_INSTANTIATE(int32_t)
+
+#undef SDRHUFF_INSTANTIATE
+
+}
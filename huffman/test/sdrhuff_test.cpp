@@ -0,0 +1,510 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "checksum.h"
+#include "container.h"
+#include "sdrhuff.h"
+
+using namespace std;
+
+// Round-trip checks of libsdrhuff, run by ctest. Prints every failed check and
+// exits with the number of failures.
+
+static int failures = 0;
+
+static void check(bool condition, const string &what) {
+    if (!condition) {
+        cerr << "FAILED: " << what << "\n";
+        failures++;
+    }
+}
+
+// Sine wave with Gaussian noise and rare large spikes, like the spikes model of
+// generate-input
+template <typename T>
+static vector<T> spikes(size_t n, unsigned seed) {
+    mt19937 rng(seed);
+    normal_distribution<double> noise(0, 0.2);
+    uniform_real_distribution<double> uniform(0, 1);
+    vector<T> data(n);
+    for (size_t i = 0; i < n; ++i) {
+        double value = sin(i * 2 * M_PI / 100) * 10 + 10 + noise(rng);
+        if (uniform(rng) < 1E-3) {
+            value += 100 * (2 * uniform(rng) - 1);
+        }
+        data[i] = (T)value;
+    }
+    return data;
+}
+
+// Every sample must decode within the bound recorded in the container
+template <typename T>
+static void testBound(const string &name, const vector<T> &data, const sdrhuff::CompressionParams &params,
+                      const sdrhuff::HuffmanDictionary *dictionary = nullptr) {
+    vector<uint8_t> compressed;
+    try {
+        sdrhuff::CompressionContext ctx;
+        sdrhuff::compress(ctx, data.data(), data.size(), params, compressed);
+    } catch (const exception &e) {
+        check(false, name + ": compress threw " + e.what());
+        return;
+    }
+    sdrhuff::DecompressionContext ctx;
+    ctx.dictionary = dictionary;
+    sdrhuff::ErrorStats stats;
+    vector<T> decoded;
+    sdrhuff::decompressAndVerify(ctx, compressed.data(), compressed.size(), data.data(), decoded, stats);
+    check(stats.count == data.size(), name + ": sample count");
+    check(stats.violations == 0, name + ": " + to_string(stats.violations) + " samples past the bound, max error " +
+                                     to_string(stats.maxError));
+}
+
+template <typename T>
+static void testBounds(const string &type) {
+    const vector<T> data = spikes<T>(100000, 1);
+    for (ExtrapolationMethod method : {linear, quadratic, regression}) {
+        for (double error : {1E-1, 1E-2, 1E-4}) {
+            sdrhuff::CompressionParams params;
+            params.error = error;
+            params.extrapolationMethod = method;
+            params.blockSize = 1 << 14;
+            const string name = type + " method " + to_string(method) + " error " + to_string(error);
+            testBound(name, data, params);
+            if (sdrhuff::zstdSupported()) {
+                params.coder = sdrhuff::zstdCoder;
+                testBound(name + " zstd", data, params);
+                params.coder = sdrhuff::huffmanZstdCoder;
+                testBound(name + " huffman+zstd", data, params);
+                params.coder = sdrhuff::huffmanCoder;
+            }
+            params.levels = 4;
+            testBound(name + " progressive", data, params);
+        }
+    }
+}
+
+// Every sample stays within its point-wise relative bound, zeros and negative
+// samples included
+template <typename T>
+static void testPointwise(const string &type) {
+    vector<T> data = spikes<T>(100000, 8);
+    for (size_t i = 0; i < data.size(); i += 7) {
+        data[i] = i % 2 ? -data[i] : 0;
+    }
+    for (double error : {1E-1, 1E-2, 1E-3}) {
+        sdrhuff::CompressionParams params;
+        params.errorMode = pointwise;
+        params.error = error;
+        params.blockSize = 1 << 14;
+        const string name = type + " point-wise " + to_string(error);
+        testBound(name, data, params);
+        const vector<T> decoded = sdrhuff::decompress<T>(sdrhuff::compress(data, params));
+        size_t violations = 0;
+        for (size_t i = 0; i < data.size(); ++i) {
+            violations += abs((double)decoded[i] - data[i]) > error * abs((double)data[i]);
+        }
+        check(violations == 0, name + ": " + to_string(violations) + " samples past the relative bound");
+    }
+}
+
+// The whole reconstruction reaches the target PSNR, not just the sample the
+// search looks at
+template <typename T>
+static void testPsnr(const string &type) {
+    const vector<T> data = spikes<T>(300000, 9);
+    for (int levels : {0, 4}) {
+        for (double target : {40.0, 60.0, 80.0}) {
+            sdrhuff::CompressionParams params;
+            params.errorMode = psnr;
+            params.error = target;
+            params.levels = levels;
+            const string name = type + " PSNR " + to_string(target) + " levels " + to_string(levels);
+            testBound(name, data, params);
+            const vector<uint8_t> compressed = sdrhuff::compress(data, params);
+            sdrhuff::DecompressionContext ctx;
+            sdrhuff::ErrorStats stats;
+            vector<T> decoded;
+            sdrhuff::decompressAndVerify(ctx, compressed.data(), compressed.size(), data.data(), decoded, stats);
+            check(stats.psnr() >= target, name + ": reached " + to_string(stats.psnr()) + " dB");
+        }
+    }
+}
+
+// Fixed-rate output has exactly the size fixedRateSize predicts, whatever the
+// length of the last block, and stays within the per-block bounds
+static void testFixedRate(size_t n, double bitsPerSample, bool reuseTables = false) {
+    const string name = "fixed rate n " + to_string(n) + " bps " + to_string(bitsPerSample) +
+                        (reuseTables ? " reuse" : "");
+    sdrhuff::CompressionParams params;
+    params.errorMode = fixedRate;
+    params.error = bitsPerSample;
+    params.blockSize = 4096;
+    params.reuseTables = reuseTables;
+    const vector<float> data = spikes<float>(n, 2);
+    testBound(name, data, params);
+    try {
+        const vector<uint8_t> compressed = sdrhuff::compress(data, params);
+        check(compressed.size() == sdrhuff::fixedRateSize(n, bitsPerSample, params.blockSize),
+              name + ": size differs from fixedRateSize");
+    } catch (const exception &e) {
+        check(false, name + ": compress threw " + e.what());
+    }
+}
+
+static void testFixedRates() {
+    // Short tail blocks, tiny inputs and the lowest rate
+    testFixedRate(4 * 4096 + 5, 8);
+    testFixedRate(4 * 4096 + 1, 4);
+    testFixedRate(3, 8);
+    testFixedRate(1, 8);
+    testFixedRate(50000, 1);
+    testFixedRate(50000, 2.5);
+    // Reused tables carry an escape codeword that the budget must account for
+    testFixedRate(50000, 1, true);
+    testFixedRate(50000, 4, true);
+    testFixedRate(4 * 4096 + 5, 8, true);
+
+    sdrhuff::CompressionParams params;
+    params.errorMode = fixedRate;
+    params.error = 0.5;
+    bool rejected = false;
+    try {
+        sdrhuff::compress(spikes<float>(1000, 3), params);
+    } catch (const invalid_argument &) {
+        rejected = true;
+    }
+    check(rejected, "fixed rate below 1 bit per sample is rejected");
+}
+
+// Compresses with and without the option under test; both must decode to
+// the same samples and within the bound
+template <typename T>
+static size_t compressedSize(const string &name, const vector<T> &data, const sdrhuff::CompressionParams &params,
+                             const sdrhuff::HuffmanDictionary *dictionary = nullptr) {
+    testBound(name, data, params, dictionary);
+    vector<uint8_t> compressed = sdrhuff::compress(data, params);
+    sdrhuff::DecompressionContext ctx;
+    ctx.dictionary = dictionary;
+    vector<T> decoded;
+    sdrhuff::decompress(ctx, compressed.data(), compressed.size(), decoded);
+    sdrhuff::CompressionParams plain = params;
+    plain.reuseTables = false;
+    plain.dictionary = nullptr;
+    check(decoded == sdrhuff::decompress<T>(sdrhuff::compress(data, plain)), name + ": decoded samples differ");
+    return compressed.size();
+}
+
+// Blocks of stationary data share their statistics, so reusing the first table
+// must beat storing a tree per block
+static void testTableReuse() {
+    const vector<float> data = spikes<float>(64 * 4096, 4);
+    sdrhuff::CompressionParams params;
+    params.error = 1E-2;
+    params.blockSize = 4096;
+    const size_t plainSize = compressedSize("table reuse off", data, params);
+    params.reuseTables = true;
+    const size_t reuseSize = compressedSize("table reuse on", data, params);
+    check(reuseSize < plainSize, "table reuse: " + to_string(reuseSize) + " B is not below " +
+                                     to_string(plainSize) + " B without reuse");
+}
+
+// The estimate is the size of a Huffman-coded container with a table per
+// block, whatever the context was last used for
+static void testEstimate() {
+    const vector<float> data = spikes<float>(100000, 12);
+    sdrhuff::CompressionParams params;
+    params.error = 1E-2;
+    sdrhuff::CompressionContext ctx;
+    const size_t size = sdrhuff::compress(data, params).size();
+    check(sdrhuff::estimate(ctx, data.data(), data.size(), params).size == size, "estimate matches compress");
+    params.reuseTables = true;
+    vector<uint8_t> compressed;
+    sdrhuff::compress(ctx, data.data(), data.size(), params, compressed);
+    params.reuseTables = false;
+    check(sdrhuff::estimate(ctx, data.data(), data.size(), params).size == size,
+          "estimate after a compress with table reuse");
+}
+
+// Small files of the same kind as the training files must shrink when their
+// blocks reference the trained table instead of storing their own
+static void testDictionary() {
+    sdrhuff::CompressionParams params;
+    params.error = 1E-2;
+    sdrhuff::CompressionContext ctx;
+    sdrhuff::HuffmanDictionary dictionary;
+    for (unsigned seed = 10; seed < 30; ++seed) {
+        const vector<float> data = spikes<float>(5000, seed);
+        sdrhuff::trainDictionary(ctx, data.data(), data.size(), params, dictionary);
+    }
+
+    size_t plainSize = 0;
+    size_t dictionarySize = 0;
+    for (unsigned seed = 0; seed < 5; ++seed) {
+        const vector<float> data = spikes<float>(2000, seed);
+        const string name = "dictionary seed " + to_string(seed);
+        params.dictionary = nullptr;
+        plainSize += compressedSize(name + " off", data, params);
+        params.dictionary = &dictionary;
+        dictionarySize += compressedSize(name + " on", data, params, &dictionary);
+    }
+    check(dictionarySize < plainSize, "dictionary: " + to_string(dictionarySize) + " B is not below " +
+                                          to_string(plainSize) + " B without it");
+}
+
+// Training counts past 32 bits still give codewords that BitWriter can write,
+// and dictionary files with longer codewords are rejected
+static void testDictionaryLimits() {
+    sdrhuff::HuffmanDictionary dictionary;
+    Histogram &histogram = dictionary.histogram;
+    unsigned long long a = 1, b = 1;
+    for (int i = 1; i <= 44; ++i) {
+        histogram.add(i, (unsigned)a);
+        const unsigned long long c = a + b;
+        a = b;
+        b = c;
+    }
+    for (int i = 45; i < 30000; ++i) {
+        histogram.add(i, 1U << 31);
+    }
+    sdrhuff::CompressionContext ctx;
+    sdrhuff::CompressionParams params;
+    params.error = 1E-2;
+    const vector<float> data = spikes<float>(5000, 11);
+    try {
+        sdrhuff::trainDictionary(ctx, data.data(), data.size(), params, dictionary);
+        const vector<uint8_t> &lengths = dictionary.code.lengths;
+        check(*max_element(lengths.begin(), lengths.end()) <= sdrhuff::maxDictionaryCodeLength,
+              "dictionary codewords fit BitWriter::write");
+        params.dictionary = &dictionary;
+        compressedSize("dictionary with large counts", data, params, &dictionary);
+    } catch (const exception &e) {
+        check(false, string("training on large counts threw ") + e.what());
+    }
+
+    // A complete code with lengths 1, 2, ..., 57, 57
+    sdrhuff::HuffmanDictionary deep;
+    for (int length = 1; length <= 57; ++length) {
+        deep.code.lengths.push_back(length);
+    }
+    deep.code.lengths.push_back(57);
+    deep.id = xxhash32(deep.code.lengths.data(), deep.code.lengths.size(), (uint32_t)deep.code.minValue);
+    vector<uint8_t> file;
+    sdrhuff::writeDictionary(deep, file);
+    bool rejected = false;
+    try {
+        sdrhuff::HuffmanDictionary read;
+        sdrhuff::readDictionary(file.data(), file.size(), read);
+    } catch (const runtime_error &) {
+        rejected = true;
+    }
+    check(rejected, "dictionary with a 57-bit codeword is rejected");
+}
+
+// Container of n float samples stored as the single given block
+static vector<uint8_t> wrapBlock(sdrhuff::EntropyCoder coder, size_t n, const vector<uint8_t> &block) {
+    sdrhuff::ContainerHeader header;
+    header.coder = coder;
+    header.dims = {n};
+    header.maxError = 1E-2;
+    header.blockSize = n;
+    header.blocks.push_back({0, (uint32_t)block.size(), xxhash32(block.data(), block.size())});
+    vector<uint8_t> container(header.size());
+    sdrhuff::writeContainerHeader(header, container.data());
+    container.insert(container.end(), block.begin(), block.end());
+    return container;
+}
+
+// Container with one zstdCoder block of 50 float samples: 1-byte codes, all 0
+// except for `escapes` escaped ones, and the given outlier words. The zstd
+// frame is written by hand with a single raw block.
+static vector<uint8_t> zstdContainer(int escapes, const vector<int32_t> &outliers) {
+    const size_t n = 50;
+    vector<uint8_t> payload(n - 2, 0);
+    for (int i = 0; i < escapes; ++i) {
+        payload[i] = (uint8_t)numeric_limits<int8_t>::min();
+    }
+    const uint8_t *words = reinterpret_cast<const uint8_t *>(outliers.data());
+    payload.insert(payload.end(), words, words + outliers.size() * sizeof(int32_t));
+
+    // Single-segment frame with a 1-byte content size and no checksum
+    vector<uint8_t> block = {1, 0, 0, 0, 0, 0, 0, 0, 0};
+    const uint32_t numOutliers = outliers.size();
+    block.insert(block.end(), (const uint8_t *)&numOutliers, (const uint8_t *)&numOutliers + 4);
+    const uint32_t blockHeader = (uint32_t)payload.size() << 3 | 1;
+    const vector<uint8_t> frame = {0x28, 0xB5, 0x2F, 0xFD, 0x20, (uint8_t)payload.size(), (uint8_t)blockHeader,
+                                   (uint8_t)(blockHeader >> 8), (uint8_t)(blockHeader >> 16)};
+    block.insert(block.end(), frame.begin(), frame.end());
+    block.insert(block.end(), payload.begin(), payload.end());
+
+    return wrapBlock(sdrhuff::zstdCoder, n, block);
+}
+
+// Container with one Huffman-coded block of 50 float samples whose tree has
+// the leaves 0 and `leaf`. The first code is `leaf`, the others 0. A nonzero
+// claimedBits replaces the size of the encoded data.
+static vector<uint8_t> huffmanContainer(int leaf, unsigned long long claimedBits = 0) {
+    const size_t n = 50;
+    NodePool pool;
+    pool.reset(3);
+    Node *root = pool.create(0, 0);
+    root->left = pool.create(0, 0);
+    root->right = pool.create(leaf, 0);
+    vector<uint8_t> tree;
+    BitWriter treeWriter(tree);
+    serializeTree(root, treeWriter);
+    const unsigned bufferSize = treeWriter.flush();
+    vector<uint8_t> data;
+    BitWriter dataWriter(data);
+    for (size_t i = 0; i < n - 2; ++i) {
+        dataWriter.write(i == 0, 1);
+    }
+    const unsigned long long dataBits = dataWriter.flush();
+    const unsigned long long encodedSize = claimedBits ? claimedBits : dataBits;
+
+    vector<uint8_t> block = {1, 0, 0, 0, 0, 0, 0, 0, 0};
+    block.insert(block.end(), (const uint8_t *)&bufferSize, (const uint8_t *)&bufferSize + sizeof(bufferSize));
+    block.insert(block.end(), (const uint8_t *)&encodedSize, (const uint8_t *)&encodedSize + sizeof(encodedSize));
+    block.insert(block.end(), tree.begin(), tree.end());
+    block.insert(block.end(), data.begin(), data.end());
+    return wrapBlock(sdrhuff::huffmanCoder, n, block);
+}
+
+static bool decodes(const vector<uint8_t> &container) {
+    try {
+        sdrhuff::decompress<float>(container);
+        return true;
+    } catch (const runtime_error &) {
+        return false;
+    }
+}
+
+// The outlier count of a zstd block must match its escaped codes
+static void testCorruptOutliers() {
+    if (!sdrhuff::zstdSupported()) {
+        return;
+    }
+    check(decodes(zstdContainer(1, {5})), "zstd block with one outlier decodes");
+    check(decodes(zstdContainer(2, {5, exactMarker, 0, 0})), "zstd block with an exact outlier decodes");
+    check(!decodes(zstdContainer(2, {5})), "zstd block with too few outliers is rejected");
+    check(!decodes(zstdContainer(0, {5})), "zstd block with a spare outlier is rejected");
+    check(!decodes(zstdContainer(1, {exactMarker})), "zstd block with a truncated exact outlier is rejected");
+}
+
+// Every level count gives every 2^(L - levels)-th sample of the full decode
+static void testPreview() {
+    const vector<float> data = spikes<float>(3 * 4096 + 100, 6);
+    sdrhuff::CompressionParams params;
+    params.error = 1E-2;
+    params.blockSize = 4096;
+    params.levels = 4;
+    const vector<uint8_t> compressed = sdrhuff::compress(data, params);
+    const vector<float> decoded = sdrhuff::decompress<float>(compressed);
+    sdrhuff::DecompressionContext ctx;
+    for (int levels = 1; levels <= params.levels; ++levels) {
+        const string name = "preview levels " + to_string(levels);
+        const size_t step = (size_t)1 << (params.levels - levels);
+        const size_t size = sdrhuff::getPreviewSize(compressed.data(), compressed.size(), levels);
+        check(size == (data.size() + step - 1) / step, name + ": size");
+        vector<float> preview(size);
+        sdrhuff::decompressPreview(ctx, compressed.data(), compressed.size(), levels, preview.data(),
+                                   preview.size());
+        bool same = true;
+        for (size_t i = 0; i < size; ++i) {
+            same &= preview[i] == decoded[i * step];
+        }
+        check(same, name + ": samples differ from the full decode");
+    }
+}
+
+// A block storing fewer levels than the first one would write its samples
+// past the preview, so it must be rejected
+static void testSplicedLevels() {
+    const vector<float> data = spikes<float>(2 * 4096, 7);
+    sdrhuff::CompressionParams params;
+    params.error = 1E-2;
+    params.blockSize = 4096;
+    params.levels = 4;
+    const vector<uint8_t> four = sdrhuff::compress(data, params);
+    params.levels = 1;
+    const vector<uint8_t> one = sdrhuff::compress(data, params);
+
+    sdrhuff::ContainerHeader header, oneHeader;
+    sdrhuff::readHeader(four.data(), four.size(), header);
+    sdrhuff::readHeader(one.data(), one.size(), oneHeader);
+    const uint8_t *fourPayload = four.data() + header.size();
+    const uint8_t *onePayload = one.data() + oneHeader.size();
+    vector<uint8_t> payload(fourPayload + header.blocks[0].offset,
+                            fourPayload + header.blocks[0].offset + header.blocks[0].size);
+    header.blocks[1] = oneHeader.blocks[1];
+    header.blocks[1].offset = payload.size();
+    payload.insert(payload.end(), onePayload + oneHeader.blocks[1].offset,
+                   onePayload + oneHeader.blocks[1].offset + oneHeader.blocks[1].size);
+    vector<uint8_t> spliced(header.size());
+    sdrhuff::writeContainerHeader(header, spliced.data());
+    spliced.insert(spliced.end(), payload.begin(), payload.end());
+    check(sdrhuff::validate(spliced.data(), spliced.size()), "spliced container passes validate");
+
+    bool rejected = false;
+    try {
+        sdrhuff::DecompressionContext ctx;
+        vector<float> preview(sdrhuff::getPreviewSize(spliced.data(), spliced.size(), 1));
+        sdrhuff::decompressPreview(ctx, spliced.data(), spliced.size(), 1, preview.data(), preview.size());
+    } catch (const runtime_error &) {
+        rejected = true;
+    }
+    check(rejected, "preview of a block with another level count is rejected");
+    rejected = false;
+    try {
+        sdrhuff::decompress<float>(spliced);
+    } catch (const runtime_error &) {
+        rejected = true;
+    }
+    check(rejected, "decoding a block with another level count is rejected");
+}
+
+// Tree leaves must fit the code type, or a wider value could decode as the
+// escape code without an outlier
+static void testCorruptTree() {
+    check(decodes(huffmanContainer(5)), "Huffman block with an in-range leaf decodes");
+    check(!decodes(huffmanContainer(384)), "Huffman block with a leaf past int8_t is rejected");
+    check(!decodes(huffmanContainer(-129)), "Huffman block with a leaf below int8_t is rejected");
+}
+
+// Sizes near the top of their range must not wrap around in bounds checks
+static void testHugeSizes() {
+    check(!decodes(huffmanContainer(5, numeric_limits<unsigned long long>::max())),
+          "Huffman block claiming 2^64 - 1 data bits is rejected");
+    check(!decodes(huffmanContainer(5, numeric_limits<unsigned long long>::max() - 6)),
+          "Huffman block claiming 2^64 - 7 data bits is rejected");
+}
+
+int main() {
+    testBounds<float>("float");
+    testBounds<double>("double");
+    testBounds<int16_t>("int16");
+    testBounds<int32_t>("int32");
+    testPointwise<float>("float");
+    testPointwise<double>("double");
+    testPsnr<float>("float");
+    testPsnr<double>("double");
+    testFixedRates();
+    testTableReuse();
+    testEstimate();
+    testDictionary();
+    testDictionaryLimits();
+    testCorruptOutliers();
+    testCorruptTree();
+    testHugeSizes();
+    testPreview();
+    testSplicedLevels();
+
+    if (failures == 0) {
+        cout << "All checks passed.\n";
+    }
+    return failures;
+}
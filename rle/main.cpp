@@ -1,88 +1,345 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <vector>
 #include <iostream>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <opencv2/opencv.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 using namespace std;
 using namespace cv;
 
-int main()
+// Encoded file layout, all integers little endian:
+//   "RLE1", uint32 rows, uint32 cols, uint32 bandRows, uint32 numBands,
+//   uint64 size of each band, then the bands.
+// A band covers bandRows rows (fewer for the last one) and is a sequence of
+// (3 bytes pixel, varint run length) pairs. Runs may continue from one row to
+// the next but never cross a band, so bands encode and decode independently.
+const char magic[4] = {'R', 'L', 'E', '1'};
+const int bandRows = 64;
+
+// LEB128: 7 bits per byte, high bit set on all bytes but the last
+void writeVarint(vector<uint8_t> &out, uint64_t value)
 {
-    const string fileName = "image.jpg";
+    while (value >= 0x80)
+    {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
 
-    Mat image = imread(fileName, IMREAD_COLOR);
-    if (image.empty())
+// Reads a varint from [in, end), advancing in; false if it is truncated
+bool readVarint(const uint8_t *&in, const uint8_t *end, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && in < end; shift += 7)
     {
-        cerr << "Error loading image.\n";
-        return -1;
+        const uint8_t byte = *in++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (byte < 0x80)
+        {
+            return true;
+        }
     }
+    return false;
+}
 
-    vector<pair<Vec3b, int>> rleData;
-    Vec3b curPixel = image.at<Vec3b>(0, 0);
-    short runLength = 1;
+// Number of pixels of row[start, cols) equal to the pixel before start. A byte
+// belongs to the run iff it equals the byte 3 positions earlier, so 16 bytes
+// are compared at once against the same bytes shifted by one pixel.
+int runLength(const uint8_t *row, int start, int cols)
+{
+    const int end = cols * 3;
+    int b = start * 3;
+#ifdef __SSE2__
+    for (; b + 16 <= end; b += 16)
+    {
+        const __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + b));
+        const __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + b - 3));
+        const unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(current, previous)) ^ 0xFFFF;
+        if (mask != 0)
+        {
+            b += __builtin_ctz(mask);
+            return b / 3 - start;
+        }
+    }
+#endif
+    while (b < end && row[b] == row[b - 3])
+    {
+        ++b;
+    }
+    return b / 3 - start;
+}
+
+void appendRun(vector<uint8_t> &out, const uint8_t *pixel, uint64_t runLength)
+{
+    out.insert(out.end(), pixel, pixel + 3);
+    writeVarint(out, runLength);
+}
 
-    for (int i = 0; i < image.rows; ++i)
+// Encodes rows [firstRow, lastRow) of a CV_8UC3 image
+vector<uint8_t> encodeBand(const Mat &image, int firstRow, int lastRow)
+{
+    vector<uint8_t> out;
+    uint8_t curPixel[3];
+    memcpy(curPixel, image.ptr<uint8_t>(firstRow), 3);
+    uint64_t curRun = 0;
+    for (int i = firstRow; i < lastRow; ++i)
     {
-        for (int j = 0; j < image.cols; ++j)
+        const uint8_t *row = image.ptr<uint8_t>(i);
+        int j = 0;
+        while (j < image.cols)
         {
-            if (i == 0 && j == 0)
-                continue; // Skip the first pixel
-            Vec3b pixel = image.at<Vec3b>(i, j);
-            if (pixel == curPixel)
-            {
-                runLength++;
-            }
-            else
+            if (memcmp(row + j * 3, curPixel, 3) != 0)
             {
-                rleData.push_back(make_pair(curPixel, runLength));
-                curPixel = pixel;
-                runLength = 1;
+                appendRun(out, curPixel, curRun);
+                memcpy(curPixel, row + j * 3, 3);
+                curRun = 0;
             }
+            const int length = 1 + runLength(row, j + 1, image.cols);
+            curRun += length;
+            j += length;
         }
     }
+    appendRun(out, curPixel, curRun);
+    return out;
+}
 
-    rleData.push_back(make_pair(curPixel, runLength));
+// Calls f(band, firstRow, lastRow) for every band of rows. Bands are taken by
+// the threads in turn; the result does not depend on the number of threads.
+template <typename F>
+void forEachBand(int rows, unsigned numThreads, F &&f)
+{
+    const int numBands = (rows + bandRows - 1) / bandRows;
+    atomic<int> nextBand(0);
+    auto worker = [&]()
+    {
+        for (int band = nextBand++; band < numBands; band = nextBand++)
+        {
+            const int firstRow = band * bandRows;
+            f(band, firstRow, min(firstRow + bandRows, rows));
+        }
+    };
 
-    ofstream outfile("encoded-data.rle", ios::binary);
-    for (const auto &pair : rleData)
+    vector<thread> pool;
+    for (unsigned i = 1; i < numThreads; ++i)
     {
-        Vec3b pixel = pair.first;
-        short runLength = pair.second;
-        cout << pixel << " " << runLength << endl;
-        outfile.write(reinterpret_cast<const char *>(&pixel), sizeof(Vec3b));
-        outfile.write(reinterpret_cast<const char *>(&runLength), sizeof(short));
+        pool.emplace_back(worker);
     }
-    outfile.close();
+    worker();
+    for (thread &t : pool)
+    {
+        t.join();
+    }
+}
 
-    // Decoding
-    vector<pair<Vec3b, int>> decoded_rle_data;
-    ifstream infile("encoded-data.rle", ios::binary);
+vector<vector<uint8_t>> encode(const Mat &image, unsigned numThreads)
+{
+    vector<vector<uint8_t>> bands((image.rows + bandRows - 1) / bandRows);
+    forEachBand(image.rows, numThreads, [&](int band, int firstRow, int lastRow)
+                { bands[band] = encodeBand(image, firstRow, lastRow); });
+    return bands;
+}
 
-    while (infile.peek() != EOF)
+// Writes count copies of a 3-byte pixel to dst. Gray pixels are a memset;
+// otherwise the filled prefix is copied onto the rest, doubling each time.
+void fillPixels(uint8_t *dst, const uint8_t *pixel, size_t count)
+{
+    if (pixel[0] == pixel[1] && pixel[1] == pixel[2])
+    {
+        memset(dst, pixel[0], count * 3);
+        return;
+    }
+    memcpy(dst, pixel, 3);
+    const size_t size = count * 3;
+    for (size_t filled = 3; filled < size; filled *= 2)
     {
-        Vec3b pixel;
-        short run_length;
-        infile.read(reinterpret_cast<char *>(&pixel), sizeof(Vec3b));
-        infile.read(reinterpret_cast<char *>(&run_length), sizeof(short));
-        decoded_rle_data.push_back(make_pair(pixel, run_length));
+        memcpy(dst + filled, dst, min(filled, size - filled));
     }
-    infile.close();
+}
 
-    Mat decoded_image(image.rows, image.cols, CV_8UC3); // Assuming it is a 3-channel image
-    int position = 0;
-    for (const auto &pair : decoded_rle_data)
+// Decodes one band of [in, end) into rows [firstRow, lastRow) of image. Runs
+// are split at row ends, so the rows of the Mat need not be contiguous.
+bool decodeBand(const uint8_t *in, const uint8_t *end, Mat &image, int firstRow, int lastRow)
+{
+    int row = firstRow;
+    uint8_t *out = image.ptr<uint8_t>(row);
+    size_t left = image.cols;
+    while (in < end)
     {
-        Vec3b pixel = pair.first;
-        int run_length = pair.second;
-        for (int i = 0; i < run_length; ++i)
+        if (end - in < 3)
+        {
+            return false;
+        }
+        const uint8_t *pixel = in;
+        in += 3;
+        uint64_t length;
+        if (!readVarint(in, end, length))
+        {
+            return false;
+        }
+        while (length > 0)
         {
-            int row = position / decoded_image.cols;
-            int col = position % decoded_image.cols;
-            decoded_image.at<Vec3b>(row, col) = pixel;
-            position++;
+            if (left == 0)
+            {
+                if (++row == lastRow)
+                {
+                    return false;
+                }
+                out = image.ptr<uint8_t>(row);
+                left = image.cols;
+            }
+            const size_t count = min<uint64_t>(length, left);
+            fillPixels(out, pixel, count);
+            out += count * 3;
+            left -= count;
+            length -= count;
         }
     }
-    imwrite("decoded_image.jpg", decoded_image);
+    return row == lastRow - 1 && left == 0;
+}
 
+// Maps a whole file read-only; returns nullptr on failure
+const uint8_t *mapFile(const string &path, size_t &size)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+    struct stat info;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        size = info.st_size;
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    return data == MAP_FAILED ? nullptr : static_cast<const uint8_t *>(data);
+}
+
+// Decodes an encoded file into image; false if the file is invalid
+bool decode(const uint8_t *data, size_t size, Mat &image, unsigned numThreads)
+{
+    const size_t headerSize = sizeof(magic) + 4 * sizeof(uint32_t);
+    if (size < headerSize || memcmp(data, magic, sizeof(magic)) != 0)
+    {
+        return false;
+    }
+    uint32_t header[4];
+    memcpy(header, data + sizeof(magic), sizeof(header));
+    const uint32_t rows = header[0], cols = header[1], numBands = header[3];
+    if (rows == 0 || cols == 0 || header[2] != (uint32_t)bandRows || numBands != (rows + bandRows - 1) / bandRows ||
+        size - headerSize < numBands * sizeof(uint64_t))
+    {
+        return false;
+    }
+
+    // Offsets of the bands from their sizes
+    const uint8_t *bands = data + headerSize + numBands * sizeof(uint64_t);
+    vector<size_t> offsets(numBands + 1, 0);
+    for (uint32_t band = 0; band < numBands; ++band)
+    {
+        uint64_t bandSize;
+        memcpy(&bandSize, data + headerSize + band * sizeof(uint64_t), sizeof(bandSize));
+        if (bandSize > size - (bands - data) - offsets[band])
+        {
+            return false;
+        }
+        offsets[band + 1] = offsets[band] + bandSize;
+    }
+
+    image.create(rows, cols, CV_8UC3);
+    atomic<bool> ok(true);
+    forEachBand(rows, numThreads, [&](int band, int firstRow, int lastRow)
+                {
+                    if (!decodeBand(bands + offsets[band], bands + offsets[band + 1], image, firstRow, lastRow))
+                    {
+                        ok = false;
+                    }
+                });
+    return ok;
+}
+
+template <typename T>
+void writeValue(ofstream &out, T value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+// Usage: rle [image] [encoded file] [threads]
+int main(int argc, char *argv[])
+{
+    const string fileName = argc > 1 ? argv[1] : "image.jpg";
+    const string encodedName = argc > 2 ? argv[2] : "encoded-data.rle";
+    const unsigned numThreads = argc > 3 ? stoul(argv[3]) : max(1u, thread::hardware_concurrency());
+
+    Mat image = imread(fileName, IMREAD_COLOR);
+    if (image.empty())
+    {
+        cerr << "Error loading image.\n";
+        return -1;
+    }
+
+    auto start = chrono::high_resolution_clock::now();
+    const vector<vector<uint8_t>> bands = encode(image, numThreads);
+    auto end = chrono::high_resolution_clock::now();
+
+    ofstream outfile(encodedName, ios::binary);
+    outfile.write(magic, sizeof(magic));
+    writeValue<uint32_t>(outfile, image.rows);
+    writeValue<uint32_t>(outfile, image.cols);
+    writeValue<uint32_t>(outfile, bandRows);
+    writeValue<uint32_t>(outfile, bands.size());
+    size_t encodedSize = 0;
+    for (const vector<uint8_t> &band : bands)
+    {
+        writeValue<uint64_t>(outfile, band.size());
+        encodedSize += band.size();
+    }
+    for (const vector<uint8_t> &band : bands)
+    {
+        outfile.write(reinterpret_cast<const char *>(band.data()), band.size());
+    }
+    outfile.close();
+
+    const double rawSize = (double)image.rows * image.cols * 3;
+    const double seconds = chrono::duration<double>(end - start).count();
+    cout << "Encoded " << image.cols << "x" << image.rows << " image into " << bands.size() << " bands, "
+         << encodedSize << " bytes (ratio " << rawSize / encodedSize << ") in " << seconds << " s, "
+         << rawSize / (1024 * 1024) / seconds << " MB/s with " << numThreads << " threads\n";
+
+    // Decoding
+    size_t mappedSize = 0;
+    const uint8_t *mapped = mapFile(encodedName, mappedSize);
+    if (!mapped)
+    {
+        cerr << "Error reading " << encodedName << ".\n";
+        return -1;
+    }
+    Mat decoded_image;
+    start = chrono::high_resolution_clock::now();
+    const bool decoded = decode(mapped, mappedSize, decoded_image, numThreads);
+    end = chrono::high_resolution_clock::now();
+    munmap(const_cast<uint8_t *>(mapped), mappedSize);
+    if (!decoded)
+    {
+        cerr << "Invalid encoded file.\n";
+        return -1;
+    }
+    const double decodeSeconds = chrono::duration<double>(end - start).count();
+    cout << "Decoded in " << decodeSeconds << " s, " << rawSize / (1024 * 1024) / decodeSeconds << " MB/s\n";
+    imwrite("decoded_image.jpg", decoded_image);
 
     return 0;
 }
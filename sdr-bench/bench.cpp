@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "sdrhuff.h"
+#include "shuffle.h"
+
+using namespace std;
+namespace fs = filesystem;
+
+// Common interface of the codecs under comparison. Inputs are raw float32
+// arrays; the output buffers are reused across calls.
+struct Codec
+{
+    virtual ~Codec() = default;
+    virtual string name() const = 0;
+    // Absolute error bound of a lossy codec, 0 for lossless ones
+    virtual double maxError() const { return 0; }
+    virtual void compress(const vector<uint8_t> &src, vector<uint8_t> &dst) = 0;
+    // dst is resized to the original size before the call
+    virtual void decompress(const vector<uint8_t> &src, vector<uint8_t> &dst) = 0;
+};
+
+// Prediction + quantization (libsdrhuff) with an absolute error bound, and
+// Huffman coding or one of the zstd back-ends for the quantization codes
+struct HuffmanCodec : Codec
+{
+    sdrhuff::CompressionParams params;
+    sdrhuff::CompressionContext compressionContext;
+    sdrhuff::DecompressionContext decompressionContext;
+    string methodName;
+
+    HuffmanCodec(double error, ExtrapolationMethod method, const string &methodName,
+                 sdrhuff::EntropyCoder coder = sdrhuff::huffmanCoder)
+        : methodName(methodName)
+    {
+        params.error = error;
+        params.extrapolationMethod = method;
+        params.coder = coder;
+    }
+
+    string name() const override
+    {
+        static const char *coderNames[] = {"huffman", "quant+zstd", "huffman+zstd"};
+        ostringstream out;
+        out << coderNames[params.coder] << "-" << methodName << " " << params.error;
+        return out.str();
+    }
+
+    double maxError() const override { return params.error; }
+
+    void compress(const vector<uint8_t> &src, vector<uint8_t> &dst) override
+    {
+        sdrhuff::compress(compressionContext, reinterpret_cast<const float *>(src.data()),
+                          src.size() / sizeof(float), params, dst);
+    }
+
+    void decompress(const vector<uint8_t> &src, vector<uint8_t> &dst) override
+    {
+        sdrhuff::decompress(decompressionContext, src.data(), src.size(),
+                            reinterpret_cast<float *>(dst.data()), dst.size() / sizeof(float));
+    }
+};
+
+struct ZlibCodec : Codec
+{
+    int level;
+
+    explicit ZlibCodec(int level) : level(level) {}
+
+    string name() const override { return "zlib " + to_string(level); }
+
+    void compress(const vector<uint8_t> &src, vector<uint8_t> &dst) override
+    {
+        uLongf size = compressBound(src.size());
+        dst.resize(size);
+        if (compress2(dst.data(), &size, src.data(), src.size(), level) != Z_OK)
+        {
+            throw runtime_error("zlib compression failed.");
+        }
+        dst.resize(size);
+    }
+
+    void decompress(const vector<uint8_t> &src, vector<uint8_t> &dst) override
+    {
+        uLongf size = dst.size();
+        if (uncompress(dst.data(), &size, src.data(), src.size()) != Z_OK || size != dst.size())
+        {
+            throw runtime_error("zlib decompression failed.");
+        }
+    }
+};
+
+#ifdef HAVE_ZSTD
+struct ZstdCodec : Codec
+{
+    int level;
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+
+    explicit ZstdCodec(int level) : level(level) {}
+    ~ZstdCodec() override
+    {
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+    }
+
+    string name() const override { return "zstd " + to_string(level); }
+
+    void compress(const vector<uint8_t> &src, vector<uint8_t> &dst) override
+    {
+        dst.resize(ZSTD_compressBound(src.size()));
+        const size_t size = ZSTD_compressCCtx(cctx, dst.data(), dst.size(), src.data(), src.size(), level);
+        if (ZSTD_isError(size))
+        {
+            throw runtime_error(string("zstd compression failed: ") + ZSTD_getErrorName(size));
+        }
+        dst.resize(size);
+    }
+
+    void decompress(const vector<uint8_t> &src, vector<uint8_t> &dst) override
+    {
+        const size_t size = ZSTD_decompressDCtx(dctx, dst.data(), dst.size(), src.data(), src.size());
+        if (ZSTD_isError(size) || size != dst.size())
+        {
+            throw runtime_error("zstd decompression failed.");
+        }
+    }
+};
+#endif
+
+// Runs a lossless codec on filtered input, e.g. byte-shuffled floats, and
+// inverts the filter after decompression. Filtering is part of the timings.
+struct FilteredCodec : Codec
+{
+    Filter filter;
+    unique_ptr<Codec> codec;
+    vector<uint8_t> filtered;
+
+    FilteredCodec(const Filter &filter, Codec *codec) : filter(filter), codec(codec) {}
+
+    string name() const override { return filter.name() + " " + codec->name(); }
+
+    void compress(const vector<uint8_t> &src, vector<uint8_t> &dst) override
+    {
+        filter.apply(src, filtered);
+        codec->compress(filtered, dst);
+    }
+
+    void decompress(const vector<uint8_t> &src, vector<uint8_t> &dst) override
+    {
+        filtered.resize(dst.size());
+        codec->decompress(src, filtered);
+        filter.invert(filtered, dst);
+    }
+};
+
+// Lossless codecs must reproduce the input byte for byte. Lossy ones must stay
+// within the bound: the decoded floats themselves are checked, so any
+// rounding of the reconstruction must already be accounted for by the codec.
+bool verify(const Codec &codec, const vector<uint8_t> &original, const vector<uint8_t> &decoded,
+            double &maxError)
+{
+    if (codec.maxError() == 0)
+    {
+        maxError = 0;
+        return original == decoded;
+    }
+    const float *x = reinterpret_cast<const float *>(original.data());
+    const float *y = reinterpret_cast<const float *>(decoded.data());
+    bool ok = true;
+    for (size_t i = 0; i < original.size() / sizeof(float); ++i)
+    {
+        const double error = abs((double)y[i] - x[i]);
+        maxError = max(maxError, error);
+        ok &= error <= codec.maxError();
+    }
+    return ok;
+}
+
+// Best time out of `repetitions` runs of f, after `warmup` untimed ones
+template <typename F>
+double bestTime(int warmup, int repetitions, F &&f)
+{
+    for (int i = 0; i < warmup; ++i)
+    {
+        f();
+    }
+    double best = numeric_limits<double>::infinity();
+    for (int i = 0; i < repetitions; ++i)
+    {
+        auto start = chrono::high_resolution_clock::now();
+        f();
+        auto end = chrono::high_resolution_clock::now();
+        best = min(best, chrono::duration<double>(end - start).count());
+    }
+    return best;
+}
+
+vector<uint8_t> readFile(const fs::path &path)
+{
+    ifstream file(path, ios::binary | ios::ate);
+    vector<uint8_t> bytes(file.tellg());
+    file.seekg(0, ios::beg);
+    file.read(reinterpret_cast<char *>(bytes.data()), bytes.size());
+    return bytes;
+}
+
+// Usage: sdr_bench [data directory] [error] [repetitions]
+// Every codec runs on the same float32 files, loaded into memory once, and
+// reports totals over all files.
+int main(int argc, char *argv[])
+{
+    const fs::path dataPath = argc > 1 ? argv[1] : "data";
+    const double error = argc > 2 ? stod(argv[2]) : 1E-2;
+    const int repetitions = argc > 3 ? stoi(argv[3]) : 5;
+    const int warmup = 1;
+
+    vector<vector<uint8_t>> files;
+    for (const auto &entry : fs::directory_iterator(dataPath))
+    {
+        if (fs::is_regular_file(entry))
+        {
+            files.push_back(readFile(entry.path()));
+        }
+    }
+
+    vector<unique_ptr<Codec>> codecs;
+    codecs.emplace_back(new HuffmanCodec(error, linear, "linear"));
+    codecs.emplace_back(new HuffmanCodec(error, regression, "regression"));
+    if (sdrhuff::zstdSupported())
+    {
+        for (sdrhuff::EntropyCoder coder : {sdrhuff::zstdCoder, sdrhuff::huffmanZstdCoder})
+        {
+            codecs.emplace_back(new HuffmanCodec(error, linear, "linear", coder));
+            codecs.emplace_back(new HuffmanCodec(error, regression, "regression", coder));
+        }
+    }
+    for (int level : {1, 6, 9})
+    {
+        codecs.emplace_back(new ZlibCodec(level));
+    }
+#ifdef HAVE_ZSTD
+    for (int level : {1, 3, 9, 19})
+    {
+        codecs.emplace_back(new ZstdCodec(level));
+    }
+#endif
+
+    // Preconditioned float32 input for the default level of each lossless codec
+    vector<Filter> filters(4);
+    filters[0].shuffle = filters[2].shuffle = Shuffle::byte;
+    filters[1].shuffle = filters[3].shuffle = Shuffle::bit;
+    filters[2].delta = filters[3].delta = true;
+    for (const Filter &filter : filters)
+    {
+        codecs.emplace_back(new FilteredCodec(filter, new ZlibCodec(6)));
+#ifdef HAVE_ZSTD
+        codecs.emplace_back(new FilteredCodec(filter, new ZstdCodec(3)));
+#endif
+    }
+
+    cout << left << setw(36) << "codec" << setw(10) << "ratio" << setw(18) << "compress MB/s"
+         << setw(18) << "decompress MB/s" << setw(14) << "max error" << "verified\n";
+
+    vector<uint8_t> compressed, decompressed;
+    for (const unique_ptr<Codec> &codec : codecs)
+    {
+        double originalSize = 0, compressedSize = 0;
+        double compressionTime = 0, decompressionTime = 0;
+        double maxError = 0;
+        bool verified = true;
+        for (const vector<uint8_t> &file : files)
+        {
+            auto compress = [&] { codec->compress(file, compressed); };
+            auto decompress = [&] { codec->decompress(compressed, decompressed); };
+            compressionTime += bestTime(warmup, repetitions, compress);
+            decompressed.assign(file.size(), 0);
+            decompressionTime += bestTime(warmup, repetitions, decompress);
+            verified &= verify(*codec, file, decompressed, maxError);
+            originalSize += file.size();
+            compressedSize += compressed.size();
+        }
+
+        const double megabytes = originalSize / (1024 * 1024);
+        cout << left << setw(36) << codec->name() << setw(10) << originalSize / compressedSize
+             << setw(18) << megabytes / compressionTime << setw(18) << megabytes / decompressionTime
+             << setw(14) << maxError << (verified ? "yes" : "NO") << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef RSS_H
+#define RSS_H
+
+#include <sys/resource.h>
+
+// Peak resident set size of the process so far, in MB
+inline double peakRssMegabytes()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // ru_maxrss is in KB on Linux
+    return usage.ru_maxrss / 1024.0;
+}
+
+#endif // RSS_H
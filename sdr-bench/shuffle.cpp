@@ -0,0 +1,307 @@
+#include "shuffle.h"
+
+#include <cstring>
+#include <stdexcept>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __SSE2__
+// Interleaves the first and the second half of the 64 bytes in v0..v3 (a
+// perfect shuffle), which rotates the 6-bit byte index left by one bit. Four
+// rounds transpose 16 elements of 4 bytes into 4 planes of 16 bytes, two more
+// rounds transpose them back.
+static inline void interleave(__m128i &v0, __m128i &v1, __m128i &v2, __m128i &v3)
+{
+    const __m128i a = _mm_unpacklo_epi8(v0, v2);
+    const __m128i b = _mm_unpackhi_epi8(v0, v2);
+    const __m128i c = _mm_unpacklo_epi8(v1, v3);
+    const __m128i d = _mm_unpackhi_epi8(v1, v3);
+    v0 = a;
+    v1 = b;
+    v2 = c;
+    v3 = d;
+}
+#endif
+
+// Transposes the 8x8 bit matrix whose rows are the bytes of x, so that bit b
+// of byte i becomes bit i of byte b
+static inline uint64_t transpose8(uint64_t x)
+{
+    uint64_t t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x ^= t ^ (t << 28);
+    return x;
+}
+
+void byteShuffle(const uint8_t *src, uint8_t *dst, size_t size, size_t typeSize)
+{
+    const size_t n = size / typeSize;
+    size_t i = 0;
+#ifdef __SSE2__
+    if (typeSize == 4)
+    {
+        for (; i + 16 <= n; i += 16)
+        {
+            const __m128i *in = reinterpret_cast<const __m128i *>(src + i * 4);
+            __m128i v0 = _mm_loadu_si128(in), v1 = _mm_loadu_si128(in + 1);
+            __m128i v2 = _mm_loadu_si128(in + 2), v3 = _mm_loadu_si128(in + 3);
+            for (int round = 0; round < 4; ++round)
+            {
+                interleave(v0, v1, v2, v3);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), v0);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + n + i), v1);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 2 * n + i), v2);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 3 * n + i), v3);
+        }
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        for (size_t k = 0; k < typeSize; ++k)
+        {
+            dst[k * n + i] = src[i * typeSize + k];
+        }
+    }
+    memcpy(dst + n * typeSize, src + n * typeSize, size - n * typeSize);
+}
+
+void byteUnshuffle(const uint8_t *src, uint8_t *dst, size_t size, size_t typeSize)
+{
+    const size_t n = size / typeSize;
+    size_t i = 0;
+#ifdef __SSE2__
+    if (typeSize == 4)
+    {
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + n + i));
+            __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * n + i));
+            __m128i v3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 3 * n + i));
+            interleave(v0, v1, v2, v3);
+            interleave(v0, v1, v2, v3);
+            __m128i *out = reinterpret_cast<__m128i *>(dst + i * 4);
+            _mm_storeu_si128(out, v0);
+            _mm_storeu_si128(out + 1, v1);
+            _mm_storeu_si128(out + 2, v2);
+            _mm_storeu_si128(out + 3, v3);
+        }
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        for (size_t k = 0; k < typeSize; ++k)
+        {
+            dst[i * typeSize + k] = src[k * n + i];
+        }
+    }
+    memcpy(dst + n * typeSize, src + n * typeSize, size - n * typeSize);
+}
+
+void bitShuffle(const uint8_t *src, uint8_t *dst, size_t size, size_t typeSize)
+{
+    const size_t n = size / typeSize & ~(size_t)7;
+    const size_t planeSize = n / 8;
+    size_t i = 0;
+#ifdef __SSE2__
+    // Byte planes of 16 elements, then bit 7 of each byte is collected by
+    // movemask while the bytes are shifted left one bit at a time
+    if (typeSize == 4)
+    {
+        for (; i + 16 <= n; i += 16)
+        {
+            const __m128i *in = reinterpret_cast<const __m128i *>(src + i * 4);
+            __m128i v[4] = {_mm_loadu_si128(in), _mm_loadu_si128(in + 1), _mm_loadu_si128(in + 2),
+                            _mm_loadu_si128(in + 3)};
+            for (int round = 0; round < 4; ++round)
+            {
+                interleave(v[0], v[1], v[2], v[3]);
+            }
+            for (size_t k = 0; k < 4; ++k)
+            {
+                for (int bit = 7; bit >= 0; --bit)
+                {
+                    const uint16_t mask = _mm_movemask_epi8(v[k]);
+                    memcpy(dst + (k * 8 + bit) * planeSize + i / 8, &mask, sizeof(mask));
+                    v[k] = _mm_add_epi8(v[k], v[k]);
+                }
+            }
+        }
+    }
+#endif
+    for (; i < n; i += 8)
+    {
+        for (size_t k = 0; k < typeSize; ++k)
+        {
+            uint64_t x = 0;
+            for (size_t j = 0; j < 8; ++j)
+            {
+                x |= (uint64_t)src[(i + j) * typeSize + k] << (8 * j);
+            }
+            x = transpose8(x);
+            for (size_t bit = 0; bit < 8; ++bit)
+            {
+                dst[(k * 8 + bit) * planeSize + i / 8] = (uint8_t)(x >> (8 * bit));
+            }
+        }
+    }
+    memcpy(dst + n * typeSize, src + n * typeSize, size - n * typeSize);
+}
+
+void bitUnshuffle(const uint8_t *src, uint8_t *dst, size_t size, size_t typeSize)
+{
+    const size_t n = size / typeSize & ~(size_t)7;
+    const size_t planeSize = n / 8;
+    for (size_t i = 0; i < n; i += 8)
+    {
+        for (size_t k = 0; k < typeSize; ++k)
+        {
+            uint64_t x = 0;
+            for (size_t bit = 0; bit < 8; ++bit)
+            {
+                x |= (uint64_t)src[(k * 8 + bit) * planeSize + i / 8] << (8 * bit);
+            }
+            x = transpose8(x);
+            for (size_t j = 0; j < 8; ++j)
+            {
+                dst[(i + j) * typeSize + k] = (uint8_t)(x >> (8 * j));
+            }
+        }
+    }
+    memcpy(dst + n * typeSize, src + n * typeSize, size - n * typeSize);
+}
+
+template <typename T>
+static void deltaEncode(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    T previous = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        T value;
+        memcpy(&value, src + i * sizeof(T), sizeof(T));
+        const T delta = value - previous;
+        memcpy(dst + i * sizeof(T), &delta, sizeof(T));
+        previous = value;
+    }
+}
+
+template <typename T>
+static void deltaDecode(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    T value = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        T delta;
+        memcpy(&delta, src + i * sizeof(T), sizeof(T));
+        value += delta;
+        memcpy(dst + i * sizeof(T), &value, sizeof(T));
+    }
+}
+
+// Runs the delta encoder or decoder on the unsigned type of typeSize bytes
+template <bool decode>
+static void delta(const uint8_t *src, uint8_t *dst, size_t size, size_t typeSize)
+{
+    const size_t n = size / typeSize;
+    switch (typeSize)
+    {
+    case 1:
+        decode ? deltaDecode<uint8_t>(src, dst, n) : deltaEncode<uint8_t>(src, dst, n);
+        break;
+    case 2:
+        decode ? deltaDecode<uint16_t>(src, dst, n) : deltaEncode<uint16_t>(src, dst, n);
+        break;
+    case 4:
+        decode ? deltaDecode<uint32_t>(src, dst, n) : deltaEncode<uint32_t>(src, dst, n);
+        break;
+    case 8:
+        decode ? deltaDecode<uint64_t>(src, dst, n) : deltaEncode<uint64_t>(src, dst, n);
+        break;
+    default:
+        throw invalid_argument("Delta filter needs elements of 1, 2, 4 or 8 bytes.");
+    }
+    memmove(dst + n * typeSize, src + n * typeSize, size - n * typeSize);
+}
+
+void deltaEncode(const uint8_t *src, uint8_t *dst, size_t size, size_t typeSize)
+{
+    delta<false>(src, dst, size, typeSize);
+}
+
+void deltaDecode(const uint8_t *src, uint8_t *dst, size_t size, size_t typeSize)
+{
+    delta<true>(src, dst, size, typeSize);
+}
+
+string Filter::name() const
+{
+    string result = delta ? "delta" : "";
+    if (shuffle != Shuffle::none)
+    {
+        result += result.empty() ? "" : "+";
+        result += shuffle == Shuffle::byte ? "byteshuffle" : "bitshuffle";
+    }
+    return result;
+}
+
+void Filter::apply(const vector<uint8_t> &src, vector<uint8_t> &dst)
+{
+    dst.resize(src.size());
+    if (shuffle == Shuffle::none)
+    {
+        if (delta)
+        {
+            deltaEncode(src.data(), dst.data(), src.size(), typeSize);
+        }
+        else
+        {
+            memcpy(dst.data(), src.data(), src.size());
+        }
+        return;
+    }
+
+    const uint8_t *input = src.data();
+    if (delta)
+    {
+        scratch.resize(src.size());
+        deltaEncode(src.data(), scratch.data(), src.size(), typeSize);
+        input = scratch.data();
+    }
+    if (shuffle == Shuffle::byte)
+    {
+        byteShuffle(input, dst.data(), src.size(), typeSize);
+    }
+    else
+    {
+        bitShuffle(input, dst.data(), src.size(), typeSize);
+    }
+}
+
+void Filter::invert(const vector<uint8_t> &src, vector<uint8_t> &dst)
+{
+    if (src.size() != dst.size())
+    {
+        throw invalid_argument("Filtered and original sizes differ.");
+    }
+    switch (shuffle)
+    {
+    case Shuffle::none:
+        memcpy(dst.data(), src.data(), src.size());
+        break;
+    case Shuffle::byte:
+        byteUnshuffle(src.data(), dst.data(), src.size(), typeSize);
+        break;
+    case Shuffle::bit:
+        bitUnshuffle(src.data(), dst.data(), src.size(), typeSize);
+        break;
+    }
+    if (delta)
+    {
+        deltaDecode(dst.data(), dst.data(), dst.size(), typeSize);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef SHUFFLE_H
+#define SHUFFLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Preconditioning filters for general-purpose compressors, in the style of
+// Blosc. All of them are lossless and operate on `size` bytes of elements of
+// `typeSize` bytes; trailing bytes that do not fill a group are copied as is.
+
+// Groups byte k of every element together: all first bytes, then all second
+// bytes, and so on. The sign and exponent bytes of floats end up in long,
+// repetitive runs.
+void byteShuffle(const uint8_t *src, uint8_t *dst, size_t size, size_t typeSize);
+void byteUnshuffle(const uint8_t *src, uint8_t *dst, size_t size, size_t typeSize);
+
+// Groups bit b of every element together, typeSize * 8 bit planes of n / 8
+// bytes each. Covers the largest multiple of 8 elements.
+void bitShuffle(const uint8_t *src, uint8_t *dst, size_t size, size_t typeSize);
+void bitUnshuffle(const uint8_t *src, uint8_t *dst, size_t size, size_t typeSize);
+
+// Replaces each element by its difference to the previous one, as unsigned
+// integers modulo 2^(8 * typeSize). typeSize must be 1, 2, 4 or 8. deltaDecode
+// may run in place.
+void deltaEncode(const uint8_t *src, uint8_t *dst, size_t size, size_t typeSize);
+void deltaDecode(const uint8_t *src, uint8_t *dst, size_t size, size_t typeSize);
+
+enum class Shuffle
+{
+    none,
+    byte,
+    bit
+};
+
+// Filter stage applied before compression and inverted after decompression
+struct Filter
+{
+    Shuffle shuffle = Shuffle::none;
+    bool delta = false;
+    size_t typeSize = sizeof(float);
+
+    // e.g. "delta+bitshuffle", empty without any filter
+    string name() const;
+    // dst is resized to src.size()
+    void apply(const vector<uint8_t> &src, vector<uint8_t> &dst);
+    // dst must already have the original size
+    void invert(const vector<uint8_t> &src, vector<uint8_t> &dst);
+
+private:
+    vector<uint8_t> scratch;
+};
+
+#endif // SHUFFLE_H
@@ -4,6 +4,14 @@
 #include <zlib.h>
 #include <chrono>
 #include <filesystem>
+#include <cstring>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+
+#include "rss.h"
 
 using namespace std;
 namespace fs = filesystem;
@@ -18,13 +26,113 @@ string transformString(const string& inputString) {
     return outputString;
 }
 
-int main()
+// Totals over all files, added to by the worker threads
+struct Totals
 {
-    // Path to the input
-    string dataPath = "data";
+    atomic<uint64_t> originalSize{0};
+    atomic<uint64_t> compressedSize{0};
+    atomic<uint64_t> compressionNanoseconds{0};
+    atomic<uint64_t> decompressionNanoseconds{0};
+    // Serializes the per-file reports
+    mutex outputMutex;
+};
+
+// Compresses one file in a single call, writes it to output-zlib/ and verifies
+// the round trip, adding to totals. Returns false on error.
+bool compressFile(const string &inputFilePath, Totals &totals)
+{
+    string outputFilePath = transformString(inputFilePath);
+
+    // Open the input file in binary mode and move the file pointer to the end
+    ifstream inputFile(inputFilePath, ios::binary | ios::ate);
+    streamsize fileSize = inputFile.tellg();
+    inputFile.seekg(0, ios::beg);
+
+    // Read the file into a buffer
+    vector<char> buffer(fileSize);
+    if (!inputFile.read(buffer.data(), fileSize))
+    {
+        cerr << "Error reading the file." << endl;
+        return false;
+    }
+
+    // Allocate memory for compressed data
+    uLong maxCompressedSize = compressBound(fileSize);
+    vector<char> compressedData(maxCompressedSize);
+
+    // Start timer
+    auto startTime = chrono::high_resolution_clock::now();
+
+    // Compress the data
+    int result = compress2(reinterpret_cast<Bytef*>(compressedData.data()), &maxCompressedSize, 
+                           reinterpret_cast<const Bytef*>(buffer.data()), fileSize, Z_BEST_SPEED);
+    if (result != Z_OK)
+    {
+        cerr << "Error compressing the data: " << result << endl;
+        return false;
+    }
+
+    // End timer
+    auto endTime = chrono::high_resolution_clock::now();
+    double elapsedTime = chrono::duration<double>(endTime - startTime).count();
+
+    // Write the compressed data to the output file
+    ofstream outputFile(outputFilePath, ios::binary);
+    outputFile.write(compressedData.data(), maxCompressedSize);
+
+    // Decompress into a preallocated buffer of the original size
+    vector<char> decompressedData(fileSize);
+    uLongf decompressedSize = fileSize;
+
+    startTime = chrono::high_resolution_clock::now();
+    result = uncompress(reinterpret_cast<Bytef*>(decompressedData.data()), &decompressedSize,
+                        reinterpret_cast<const Bytef*>(compressedData.data()), maxCompressedSize);
+    endTime = chrono::high_resolution_clock::now();
+    if (result != Z_OK)
+    {
+        cerr << "Error decompressing the data: " << result << endl;
+        return false;
+    }
+
+    // Verify the round trip byte for byte
+    if (decompressedSize != static_cast<uLongf>(fileSize) ||
+        memcmp(decompressedData.data(), buffer.data(), fileSize) != 0)
+    {
+        cerr << "Decompressed data does not match " << inputFilePath << endl;
+        return false;
+    }
+    double decompressionTime = chrono::duration<double>(endTime - startTime).count();
+
+    // Calculate
+    double compressionRatio = static_cast<double>(fileSize) / static_cast<double>(maxCompressedSize);
+
+    double throughput = (static_cast<double>(fileSize) / (1024 * 1024)) / elapsedTime;
+    double decompressionThroughput = (static_cast<double>(fileSize) / (1024 * 1024)) / decompressionTime;
+
+    // Update totals
+    totals.compressionNanoseconds += static_cast<uint64_t>(elapsedTime * 1E9);
+    totals.decompressionNanoseconds += static_cast<uint64_t>(decompressionTime * 1E9);
+    totals.originalSize += fileSize;
+    totals.compressedSize += maxCompressedSize;
+
+    lock_guard<mutex> lock(totals.outputMutex);
+    cout << "File at " << inputFilePath << " successfully compressed." << endl;
+    cout << "Compression ratio: " << compressionRatio << endl;
+    cout << "Throughput: " << throughput << " MB/s" << endl;
+    cout << "Decompression throughput: " << decompressionThroughput << " MB/s" << endl;
+    return true;
+}
+
+// Compresses every file in dataPath with deflate in chunks of chunkSize bytes and
+// inflates the output back, comparing it with the input chunk by chunk. Only a
+// few chunks and the fixed 32 KB window are held in memory, whatever the file size.
+int stream(const string &dataPath, size_t chunkSize)
+{
+    vector<char> in(chunkSize), out(chunkSize), expected(chunkSize);
 
     // Keep track of totals
     double totalTime = 0;
+    double totalDecompressionTime = 0;
     double totalOriginalSize = 0;
     double totalCompressedSize = 0;
 
@@ -35,66 +143,201 @@ int main()
             string inputFilePath = entry.path();
             string outputFilePath = transformString(inputFilePath);
 
-            // Open the input file in binary mode and move the file pointer to the end
-            ifstream inputFile(inputFilePath, ios::binary | ios::ate);
-            streamsize fileSize = inputFile.tellg();
-            inputFile.seekg(0, ios::beg);
+            ifstream inputFile(inputFilePath, ios::binary);
+            ofstream outputFile(outputFilePath, ios::binary);
+            double elapsedTime = 0;
+            double fileSize = 0;
+            double compressedSize = 0;
 
-            // Read the file into a buffer
-            vector<char> buffer(fileSize);
-            if (!inputFile.read(buffer.data(), fileSize))
+            // Default window and memory level, as compress2 uses
+            z_stream strm = {};
+            deflateInit2(&strm, Z_BEST_SPEED, Z_DEFLATED, 15, 8, Z_DEFAULT_STRATEGY);
+            int flush;
+            do
             {
-                cerr << "Error reading the file." << endl;
-                return 1;
-            }
+                inputFile.read(in.data(), chunkSize);
+                strm.next_in = reinterpret_cast<Bytef *>(in.data());
+                strm.avail_in = inputFile.gcount();
+                fileSize += strm.avail_in;
+                flush = inputFile.eof() ? Z_FINISH : Z_NO_FLUSH;
 
-            // Allocate memory for compressed data
-            uLong maxCompressedSize = compressBound(fileSize);
-            vector<char> compressedData(maxCompressedSize);
+                // Drain the output until deflate leaves some of it unused
+                do
+                {
+                    strm.next_out = reinterpret_cast<Bytef *>(out.data());
+                    strm.avail_out = chunkSize;
+                    auto startTime = chrono::high_resolution_clock::now();
+                    deflate(&strm, flush);
+                    auto endTime = chrono::high_resolution_clock::now();
+                    elapsedTime += chrono::duration<double>(endTime - startTime).count();
 
-            // Start timer
-            auto startTime = chrono::high_resolution_clock::now();
+                    size_t have = chunkSize - strm.avail_out;
+                    outputFile.write(out.data(), have);
+                    compressedSize += have;
+                } while (strm.avail_out == 0);
+            } while (flush != Z_FINISH);
+            deflateEnd(&strm);
+            outputFile.close();
 
-            // Compress the data
-            int result = compress2(reinterpret_cast<Bytef*>(compressedData.data()), &maxCompressedSize, 
-                                   reinterpret_cast<const Bytef*>(buffer.data()), fileSize, Z_BEST_SPEED);
-            if (result != Z_OK)
+            // Inflate the output back and compare it with a second pass over the input
+            ifstream compressedFile(outputFilePath, ios::binary);
+            ifstream originalFile(inputFilePath, ios::binary);
+            double decompressionTime = 0;
+            bool matches = true;
+            strm = {};
+            inflateInit2(&strm, 15);
+            int result = Z_OK;
+            while (result != Z_STREAM_END && matches)
             {
-                cerr << "Error compressing the data: " << result << endl;
-                return 1;
-            }
+                compressedFile.read(in.data(), chunkSize);
+                strm.next_in = reinterpret_cast<Bytef *>(in.data());
+                strm.avail_in = compressedFile.gcount();
+                if (strm.avail_in == 0)
+                {
+                    cerr << "Compressed file is truncated: " << outputFilePath << endl;
+                    return 1;
+                }
 
-            // End timer
-            auto endTime = chrono::high_resolution_clock::now();
-
-            // Write the compressed data to the output file
-            ofstream outputFile(outputFilePath, ios::binary);
-            outputFile.write(compressedData.data(), maxCompressedSize);
+                do
+                {
+                    strm.next_out = reinterpret_cast<Bytef *>(out.data());
+                    strm.avail_out = chunkSize;
+                    auto startTime = chrono::high_resolution_clock::now();
+                    result = inflate(&strm, Z_NO_FLUSH);
+                    auto endTime = chrono::high_resolution_clock::now();
+                    decompressionTime += chrono::duration<double>(endTime - startTime).count();
+                    if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+                    {
+                        cerr << "Error decompressing the data: " << result << endl;
+                        return 1;
+                    }
 
-            // Calculate
-            double compressionRatio = static_cast<double>(fileSize) / static_cast<double>(maxCompressedSize);
+                    size_t have = chunkSize - strm.avail_out;
+                    originalFile.read(expected.data(), have);
+                    matches &= static_cast<size_t>(originalFile.gcount()) == have &&
+                               memcmp(out.data(), expected.data(), have) == 0;
+                } while (strm.avail_out == 0 && matches);
+            }
+            inflateEnd(&strm);
 
-            double elapsedTime = chrono::duration<double>(endTime - startTime).count();
-            double throughput = (static_cast<double>(fileSize) / (1024 * 1024)) / elapsedTime;
+            // Verify the round trip byte for byte
+            if (!matches || originalFile.peek() != EOF)
+            {
+                cerr << "Decompressed data does not match " << inputFilePath << endl;
+                return 1;
+            }
 
             // Update totals
             totalTime += elapsedTime;
-            totalOriginalSize += static_cast<double>(fileSize);
-            totalCompressedSize += static_cast<double>(maxCompressedSize);
+            totalDecompressionTime += decompressionTime;
+            totalOriginalSize += fileSize;
+            totalCompressedSize += compressedSize;
 
             cout << "File at " << inputFilePath << " successfully compressed." << endl;
-            cout << "Compression ratio: " << compressionRatio << endl;
-            cout << "Throughput: " << throughput << " MB/s" << endl;
+            cout << "Compression ratio: " << fileSize / compressedSize << endl;
+            cout << "Throughput: " << fileSize / (1024 * 1024) / elapsedTime << " MB/s" << endl;
+            cout << "Decompression throughput: " << fileSize / (1024 * 1024) / decompressionTime << " MB/s" << endl;
+        }
+    }
+
+    cout << "-------" << endl;
+
+    cout << "Chunk size: " << chunkSize / 1024 << " KB" << endl;
+    cout << "Total compression time: " << totalTime << "s" << endl;
+    cout << "Total decompression time: " << totalDecompressionTime << "s" << endl;
+    cout << "Original size: " << totalOriginalSize / (1024 * 1024) << " MB" << endl;
+    cout << "Compressed size: " << totalCompressedSize / (1024 * 1024) << " MB" << endl;
+    cout << "Overall compression ratio: " << totalOriginalSize / totalCompressedSize << endl;
+    cout << "Overall throughput: " << totalOriginalSize / (1024 * 1024) / totalTime << " MB/s" << endl;
+    cout << "Overall decompression throughput: " << totalOriginalSize / (1024 * 1024) / totalDecompressionTime << " MB/s" << endl;
+    cout << "Peak RSS: " << peakRssMegabytes() << " MB" << endl;
+
+    return 0;
+}
+
+// Usage: zlib_bench [-j threads] [stream [chunk KB]]
+// Without arguments, compresses each file of data/ in one call into output-zlib/
+// and verifies the round trip, with -j spreading the files over that many threads;
+// "stream" does the same in chunks (1024 KB by default) on one thread.
+int main(int argc, char *argv[])
+{
+    // Path to the input
+    string dataPath = "data";
+
+    vector<string> args(argv + 1, argv + argc);
+    int threads = 1;
+    if (args.size() >= 2 && args[0] == "-j")
+    {
+        threads = max(stoi(args[1]), 1);
+        args.erase(args.begin(), args.begin() + 2);
+    }
+
+    if (!args.empty() && args[0] == "stream")
+    {
+        return stream(dataPath, (args.size() > 1 ? stoul(args[1]) : 1024) * 1024);
+    }
+
+    vector<string> files;
+    for (const auto &entry : fs::directory_iterator(dataPath))
+    {
+        if (fs::is_regular_file(entry))
+        {
+            files.push_back(entry.path());
         }
     }
-    
+
+    // Each worker takes the next file until none are left
+    Totals totals;
+    atomic<size_t> nextFile{0};
+    atomic<bool> failed{false};
+    auto worker = [&]()
+    {
+        for (size_t i = nextFile++; i < files.size() && !failed; i = nextFile++)
+        {
+            if (!compressFile(files[i], totals))
+            {
+                failed = true;
+            }
+        }
+    };
+
+    auto startTime = chrono::high_resolution_clock::now();
+    vector<thread> pool;
+    for (int i = 1; i < threads; ++i)
+    {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (thread &t : pool)
+    {
+        t.join();
+    }
+    auto endTime = chrono::high_resolution_clock::now();
+    if (failed)
+    {
+        return 1;
+    }
+
+    double totalTime = totals.compressionNanoseconds / 1E9;
+    double totalDecompressionTime = totals.decompressionNanoseconds / 1E9;
+    double totalOriginalSize = totals.originalSize;
+    double totalCompressedSize = totals.compressedSize;
+    double wallTime = chrono::duration<double>(endTime - startTime).count();
+
     cout << "-------" << endl;
 
+    cout << "Threads: " << threads << endl;
     cout << "Total compression time: " << totalTime << "s" << endl;
+    cout << "Total decompression time: " << totalDecompressionTime << "s" << endl;
     cout << "Original size: " << totalOriginalSize / (1024 * 1024) << " MB" << endl;
     cout << "Compressed size: " << totalCompressedSize / (1024 * 1024) << " MB" << endl;
     cout << "Overall compression ratio: " << totalOriginalSize / totalCompressedSize << endl;
     cout << "Overall throughput: " << totalOriginalSize / (1024 * 1024) / totalTime << " MB/s" << endl;
+    cout << "Overall decompression throughput: " << totalOriginalSize / (1024 * 1024) / totalDecompressionTime << " MB/s" << endl;
+    // Reading, compressing, writing and verifying all files with every thread
+    cout << "Wall-clock time: " << wallTime << "s" << endl;
+    cout << "Wall-clock throughput: " << totalOriginalSize / (1024 * 1024) / wallTime << " MB/s" << endl;
+    cout << "Peak RSS: " << peakRssMegabytes() << " MB" << endl;
 
     return 0;
 }
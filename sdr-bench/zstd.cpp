@@ -4,6 +4,14 @@
 #include <zstd.h>
 #include <chrono>
 #include <filesystem>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+
+#include "rss.h"
 
 using namespace std;
 namespace fs = filesystem;
@@ -18,15 +26,189 @@ string transformString(const string& inputString) {
     return outputString;
 }
 
-int main()
+// Compresses every file in dataPath with each level and worker count, reusing one
+// compression context, and prints the ratio and throughput of each combination.
+// Files are loaded once up front so that only compression is timed.
+int sweep(const string &dataPath)
 {
+    vector<vector<char>> files;
+    for (const auto &entry : fs::directory_iterator(dataPath))
+    {
+        if (fs::is_regular_file(entry))
+        {
+            ifstream inputFile(entry.path(), ios::binary | ios::ate);
+            vector<char> buffer(inputFile.tellg());
+            inputFile.seekg(0, ios::beg);
+            inputFile.read(buffer.data(), buffer.size());
+            files.push_back(move(buffer));
+        }
+    }
 
-    // Path to the input and output files
-    string dataPath = "data";
-    string outputPath = "output";
+    // 0 runs in the calling thread, n > 0 uses n background workers
+    vector<int> workerCounts = {0, 1, 2, 4};
+    for (int workers = 8; workers <= (int)thread::hardware_concurrency(); workers *= 2)
+    {
+        workerCounts.push_back(workers);
+    }
+
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    vector<char> compressedData;
+
+    cout << "Level\tWorkers\tRatio\tThroughput (MB/s)" << endl;
+    for (int level : {1, 3, 9, 19})
+    {
+        for (int workers : workerCounts)
+        {
+            ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+            size_t const result = ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, workers);
+            if (ZSTD_isError(result))
+            {
+                // libzstd was built without multithreading support
+                cout << level << "\t" << workers << "\tunsupported: " << ZSTD_getErrorName(result) << endl;
+                continue;
+            }
+
+            double totalTime = 0;
+            double totalOriginalSize = 0;
+            double totalCompressedSize = 0;
+            for (const vector<char> &buffer : files)
+            {
+                compressedData.resize(ZSTD_compressBound(buffer.size()));
+
+                auto startTime = chrono::high_resolution_clock::now();
+                size_t const compressedSize = ZSTD_compress2(cctx, compressedData.data(), compressedData.size(), buffer.data(), buffer.size());
+                auto endTime = chrono::high_resolution_clock::now();
+                if (ZSTD_isError(compressedSize))
+                {
+                    cerr << "Error compressing the data: " << ZSTD_getErrorName(compressedSize) << endl;
+                    ZSTD_freeCCtx(cctx);
+                    return 1;
+                }
+
+                totalTime += chrono::duration<double>(endTime - startTime).count();
+                totalOriginalSize += buffer.size();
+                totalCompressedSize += compressedSize;
+            }
+
+            cout << level << "\t" << workers << "\t" << totalOriginalSize / totalCompressedSize << "\t"
+                 << totalOriginalSize / (1024 * 1024) / totalTime << endl;
+        }
+    }
+
+    ZSTD_freeCCtx(cctx);
+    return 0;
+}
+
+// Totals over all files, added to by the worker threads
+struct Totals
+{
+    atomic<uint64_t> originalSize{0};
+    atomic<uint64_t> compressedSize{0};
+    atomic<uint64_t> compressionNanoseconds{0};
+    atomic<uint64_t> decompressionNanoseconds{0};
+    // Serializes the per-file reports
+    mutex outputMutex;
+};
+
+// Compresses one file in a single call with the calling thread's contexts,
+// writes it to output/ and verifies the round trip, adding to totals. Returns
+// false on error.
+bool compressFile(const string &inputFilePath, ZSTD_CCtx *cctx, ZSTD_DCtx *dctx, Totals &totals)
+{
+    string outputFilePath = transformString(inputFilePath);
+
+    // Open the input file in binary mode and move the file pointer to the end
+    ifstream inputFile(inputFilePath, ios::binary | ios::ate);
+    streamsize fileSize = inputFile.tellg();
+    inputFile.seekg(0, ios::beg);
+
+    // Read the file into a buffer
+    vector<char> buffer(fileSize);
+    if (!inputFile.read(buffer.data(), fileSize))
+    {
+        cerr << "Error reading the file." << endl;
+        return false;
+    }
+
+    // Allocate memory for compressed data
+    size_t const maxCompressedSize = ZSTD_compressBound(fileSize);
+    vector<char> compressedData(maxCompressedSize);
+
+    // Start timer
+    auto startTime = chrono::high_resolution_clock::now();
+
+    // Compress the data
+    size_t const compressedSize = ZSTD_compress2(cctx, compressedData.data(), maxCompressedSize, buffer.data(), fileSize);
+    if (ZSTD_isError(compressedSize))
+    {
+        cerr << "Error compressing the data: " << ZSTD_getErrorName(compressedSize) << endl;
+        return false;
+    }
+
+    // End timer
+    auto endTime = chrono::high_resolution_clock::now();
+    double elapsedTime = chrono::duration<double>(endTime - startTime).count();
+
+    // Write the compressed data to the output file
+    ofstream outputFile(outputFilePath, ios::binary);
+    outputFile.write(compressedData.data(), compressedSize);
+
+    // Decompress into a preallocated buffer of the original size
+    vector<char> decompressedData(fileSize);
+
+    startTime = chrono::high_resolution_clock::now();
+    size_t const decompressedSize = ZSTD_decompressDCtx(dctx, decompressedData.data(), fileSize, compressedData.data(), compressedSize);
+    endTime = chrono::high_resolution_clock::now();
+    if (ZSTD_isError(decompressedSize))
+    {
+        cerr << "Error decompressing the data: " << ZSTD_getErrorName(decompressedSize) << endl;
+        return false;
+    }
+
+    // Verify the round trip byte for byte
+    if (decompressedSize != static_cast<size_t>(fileSize) ||
+        memcmp(decompressedData.data(), buffer.data(), fileSize) != 0)
+    {
+        cerr << "Decompressed data does not match " << inputFilePath << endl;
+        return false;
+    }
+    double decompressionTime = chrono::duration<double>(endTime - startTime).count();
+
+    // Calculate
+    double compressionRatio = static_cast<double>(fileSize) / static_cast<double>(compressedSize);
+
+    double throughput = (static_cast<double>(fileSize) / (1024 * 1024)) / elapsedTime;
+    double decompressionThroughput = (static_cast<double>(fileSize) / (1024 * 1024)) / decompressionTime;
+
+    // Update totals
+    totals.compressionNanoseconds += static_cast<uint64_t>(elapsedTime * 1E9);
+    totals.decompressionNanoseconds += static_cast<uint64_t>(decompressionTime * 1E9);
+    totals.originalSize += fileSize;
+    totals.compressedSize += compressedSize;
+
+    lock_guard<mutex> lock(totals.outputMutex);
+    cout << "File at " << inputFilePath << " successfully compressed." << endl;
+    cout << "Compression ratio: " << compressionRatio << endl;
+    cout << "Throughput: " << throughput << " MB/s" << endl;
+    cout << "Decompression throughput: " << decompressionThroughput << " MB/s" << endl;
+    return true;
+}
+
+// Compresses every file in dataPath at level 3 with ZSTD_compressStream2 in
+// chunks of chunkSize bytes and decompresses the output back, comparing it with
+// the input chunk by chunk, so memory use does not grow with the file size
+int stream(const string &dataPath, size_t chunkSize)
+{
+    vector<char> in(chunkSize), out(chunkSize), expected(chunkSize);
+
+    // Contexts, reused across files
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
 
     // Keep track of totals
     double totalTime = 0;
+    double totalDecompressionTime = 0;
     double totalOriginalSize = 0;
     double totalCompressedSize = 0;
 
@@ -37,65 +219,220 @@ int main()
             string inputFilePath = entry.path();
             string outputFilePath = transformString(inputFilePath);
 
-            // Open the input file in binary mode and move the file pointer to the end
-            ifstream inputFile(inputFilePath, ios::binary | ios::ate);
-            streamsize fileSize = inputFile.tellg();
-            inputFile.seekg(0, ios::beg);
+            ifstream inputFile(inputFilePath, ios::binary);
+            ofstream outputFile(outputFilePath, ios::binary);
+            double elapsedTime = 0;
+            double fileSize = 0;
+            double compressedSize = 0;
 
-            // Read the file into a buffer
-            vector<char> buffer(fileSize);
-            if (!inputFile.read(buffer.data(), fileSize))
+            // The pledged size is recorded in the frame and caps the window for small files
+            ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, 3);
+            ZSTD_CCtx_setPledgedSrcSize(cctx, fs::file_size(entry.path()));
+            bool lastChunk;
+            do
             {
-                cerr << "Error reading the file." << endl;
-                return 1;
-            }
+                inputFile.read(in.data(), chunkSize);
+                ZSTD_inBuffer input = {in.data(), static_cast<size_t>(inputFile.gcount()), 0};
+                fileSize += input.size;
+                lastChunk = inputFile.eof();
+                const ZSTD_EndDirective mode = lastChunk ? ZSTD_e_end : ZSTD_e_continue;
 
-            // Allocate memory for compressed data
-            size_t const maxCompressedSize = ZSTD_compressBound(fileSize);
-            vector<char> compressedData(maxCompressedSize);
+                // Drain the output until the chunk is consumed (and the frame finished)
+                bool finished;
+                do
+                {
+                    ZSTD_outBuffer output = {out.data(), chunkSize, 0};
+                    auto startTime = chrono::high_resolution_clock::now();
+                    size_t const remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+                    auto endTime = chrono::high_resolution_clock::now();
+                    if (ZSTD_isError(remaining))
+                    {
+                        cerr << "Error compressing the data: " << ZSTD_getErrorName(remaining) << endl;
+                        return 1;
+                    }
+                    elapsedTime += chrono::duration<double>(endTime - startTime).count();
 
-            // Start timer
-            auto startTime = chrono::high_resolution_clock::now();
+                    outputFile.write(out.data(), output.pos);
+                    compressedSize += output.pos;
+                    finished = lastChunk ? remaining == 0 : input.pos == input.size;
+                } while (!finished);
+            } while (!lastChunk);
+            outputFile.close();
 
-            // Compress the data
-            size_t const compressedSize = ZSTD_compress(compressedData.data(), maxCompressedSize, buffer.data(), fileSize, 3);
-            if (ZSTD_isError(compressedSize))
+            // Decompress the output back and compare it with a second pass over the input
+            ifstream compressedFile(outputFilePath, ios::binary);
+            ifstream originalFile(inputFilePath, ios::binary);
+            double decompressionTime = 0;
+            bool matches = true;
+            size_t result = 1;
+            ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+            while (result != 0 && matches)
             {
-                cerr << "Error compressing the data: " << ZSTD_getErrorName(compressedSize) << endl;
-                return 1;
-            }
+                compressedFile.read(in.data(), chunkSize);
+                ZSTD_inBuffer input = {in.data(), static_cast<size_t>(compressedFile.gcount()), 0};
+                if (input.size == 0)
+                {
+                    cerr << "Compressed file is truncated: " << outputFilePath << endl;
+                    return 1;
+                }
 
-            // End timer
-            auto endTime = chrono::high_resolution_clock::now();
-
-            // Write the compressed data to the output file
-            ofstream outputFile(outputFilePath, ios::binary);
-            outputFile.write(compressedData.data(), compressedSize);
+                // A full output buffer may leave data inside the context, so keep going
+                // until the frame is complete or the input is consumed with output to spare
+                bool drained;
+                do
+                {
+                    ZSTD_outBuffer output = {out.data(), chunkSize, 0};
+                    auto startTime = chrono::high_resolution_clock::now();
+                    result = ZSTD_decompressStream(dctx, &output, &input);
+                    auto endTime = chrono::high_resolution_clock::now();
+                    if (ZSTD_isError(result))
+                    {
+                        cerr << "Error decompressing the data: " << ZSTD_getErrorName(result) << endl;
+                        return 1;
+                    }
+                    decompressionTime += chrono::duration<double>(endTime - startTime).count();
 
-            // Calculate
-            double compressionRatio = static_cast<double>(fileSize) / static_cast<double>(compressedSize);
+                    originalFile.read(expected.data(), output.pos);
+                    matches &= static_cast<size_t>(originalFile.gcount()) == output.pos &&
+                               memcmp(out.data(), expected.data(), output.pos) == 0;
+                    drained = result == 0 || (input.pos == input.size && output.pos < output.size);
+                } while (!drained && matches);
+            }
 
-            double elapsedTime = chrono::duration<double>(endTime - startTime).count();
-            double throughput = (static_cast<double>(fileSize) / (1024 * 1024)) / elapsedTime;
+            // Verify the round trip byte for byte
+            if (!matches || originalFile.peek() != EOF)
+            {
+                cerr << "Decompressed data does not match " << inputFilePath << endl;
+                return 1;
+            }
 
             // Update totals
             totalTime += elapsedTime;
-            totalOriginalSize += static_cast<double>(fileSize);
-            totalCompressedSize += static_cast<double>(compressedSize);
+            totalDecompressionTime += decompressionTime;
+            totalOriginalSize += fileSize;
+            totalCompressedSize += compressedSize;
 
             cout << "File at " << inputFilePath << " successfully compressed." << endl;
-            cout << "Compression ratio: " << compressionRatio << endl;
-            cout << "Throughput: " << throughput << " MB/s" << endl;
+            cout << "Compression ratio: " << fileSize / compressedSize << endl;
+            cout << "Throughput: " << fileSize / (1024 * 1024) / elapsedTime << " MB/s" << endl;
+            cout << "Decompression throughput: " << fileSize / (1024 * 1024) / decompressionTime << " MB/s" << endl;
+        }
+    }
+
+    cout << "-------" << endl;
+
+    cout << "Chunk size: " << chunkSize / 1024 << " KB" << endl;
+    cout << "Total compression time: " << totalTime << "s" << endl;
+    cout << "Total decompression time: " << totalDecompressionTime << "s" << endl;
+    cout << "Original size: " << totalOriginalSize / (1024 * 1024) << " MB" << endl;
+    cout << "Compressed size: " << totalCompressedSize / (1024 * 1024) << " MB" << endl;
+    cout << "Overall compression ratio: " << totalOriginalSize / totalCompressedSize << endl;
+    cout << "Overall throughput: " << totalOriginalSize / (1024 * 1024) / totalTime << " MB/s" << endl;
+    cout << "Overall decompression throughput: " << totalOriginalSize / (1024 * 1024) / totalDecompressionTime << " MB/s" << endl;
+    cout << "Peak RSS: " << peakRssMegabytes() << " MB" << endl;
+
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+
+    return 0;
+}
+
+// Usage: zstd_bench [-j threads] [sweep | stream [chunk KB]]
+// Without arguments, compresses data/ at level 3 into output/ and verifies the
+// round trip, with -j spreading the files over that many threads; "sweep"
+// compares levels and worker counts instead, and "stream" compresses in chunks
+// (1024 KB by default) instead of whole files, both on one thread.
+int main(int argc, char *argv[])
+{
+
+    // Path to the input and output files
+    string dataPath = "data";
+    string outputPath = "output";
+
+    vector<string> args(argv + 1, argv + argc);
+    int threads = 1;
+    if (args.size() >= 2 && args[0] == "-j")
+    {
+        threads = max(stoi(args[1]), 1);
+        args.erase(args.begin(), args.begin() + 2);
+    }
+
+    if (!args.empty() && args[0] == "sweep")
+    {
+        return sweep(dataPath);
+    }
+    if (!args.empty() && args[0] == "stream")
+    {
+        return stream(dataPath, (args.size() > 1 ? stoul(args[1]) : 1024) * 1024);
+    }
+
+    vector<string> files;
+    for (const auto &entry : fs::directory_iterator(dataPath))
+    {
+        if (fs::is_regular_file(entry))
+        {
+            files.push_back(entry.path());
         }
     }
-    
+
+    // Each worker reuses its own contexts and takes the next file until none are left
+    Totals totals;
+    atomic<size_t> nextFile{0};
+    atomic<bool> failed{false};
+    auto worker = [&]()
+    {
+        ZSTD_CCtx *cctx = ZSTD_createCCtx();
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, 3);
+        ZSTD_DCtx *dctx = ZSTD_createDCtx();
+        for (size_t i = nextFile++; i < files.size() && !failed; i = nextFile++)
+        {
+            if (!compressFile(files[i], cctx, dctx, totals))
+            {
+                failed = true;
+            }
+        }
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+    };
+
+    auto startTime = chrono::high_resolution_clock::now();
+    vector<thread> pool;
+    for (int i = 1; i < threads; ++i)
+    {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (thread &t : pool)
+    {
+        t.join();
+    }
+    auto endTime = chrono::high_resolution_clock::now();
+    if (failed)
+    {
+        return 1;
+    }
+
+    double totalTime = totals.compressionNanoseconds / 1E9;
+    double totalDecompressionTime = totals.decompressionNanoseconds / 1E9;
+    double totalOriginalSize = totals.originalSize;
+    double totalCompressedSize = totals.compressedSize;
+    double wallTime = chrono::duration<double>(endTime - startTime).count();
+
     cout << "-------" << endl;
 
+    cout << "Threads: " << threads << endl;
     cout << "Total compression time: " << totalTime << "s" << endl;
+    cout << "Total decompression time: " << totalDecompressionTime << "s" << endl;
     cout << "Original size: " << totalOriginalSize / (1024 * 1024) << " MB" << endl;
     cout << "Compressed size: " << totalCompressedSize / (1024 * 1024) << " MB" << endl;
     cout << "Overall compression ratio: " << totalOriginalSize / totalCompressedSize << endl;
     cout << "Overall throughput: " << totalOriginalSize / (1024 * 1024) / totalTime << " MB/s" << endl;
+    cout << "Overall decompression throughput: " << totalOriginalSize / (1024 * 1024) / totalDecompressionTime << " MB/s" << endl;
+    // Reading, compressing, writing and verifying all files with every thread
+    cout << "Wall-clock time: " << wallTime << "s" << endl;
+    cout << "Wall-clock throughput: " << totalOriginalSize / (1024 * 1024) / wallTime << " MB/s" << endl;
+    cout << "Peak RSS: " << peakRssMegabytes() << " MB" << endl;
 
     return 0;
 }